@@ -0,0 +1,874 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <core/classification_server.h>
+#include <core/fixed_model.h>
+#include <core/logger.h>
+#include <core/metrics.h>
+#include <core/model.h>
+#include <core/sample_generator.h>
+#include <core/sample_reader.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using std::chrono::steady_clock;
+
+// Every allocation made through operator new, so the benchmark can show which
+// loops still allocate once they are warmed up
+std::atomic<size_t> allocations(0);
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* memory = std::malloc(size != 0 ? size : 1);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+/**
+ * Reference scorer that multiplies raw probabilities, the way the model
+ * classified samples before it moved to log space.
+ */
+struct ProductScorer {
+    int num_pixels;
+    double prior[10];
+    vector<double> likelihood[10][2];
+
+    explicit ProductScorer(naivebayes::Model& model);
+    int Score(naivebayes::Sample& sample, bool& underflow) const;
+};
+
+/**
+ * Reference scorer that visits the rows of a sample in order and stops once
+ * one class is left, to measure how much early exit could skip. After every
+ * row a class is dropped when its best possible score is below the worst
+ * possible score of another. The bounds of the rows still ahead add up the
+ * largest, or smallest, deltas of those rows, as many as there are set
+ * bits left.
+ */
+struct PruningScorer {
+    int num_pixels;
+    double blank_scores[10];
+    vector<double> deltas;
+    // Sums of the k largest positive, and the k smallest negative, deltas of class c in
+    // rows r and below. Those of bound b = c * (num_pixels + 1) + r start at begin[b].
+    vector<double> upper;
+    vector<size_t> upper_begin;
+    vector<double> lower;
+    vector<size_t> lower_begin;
+
+    explicit PruningScorer(const naivebayes::Scorer& scorer);
+    int Score(const naivebayes::Sample& sample, size_t& rows_visited) const;
+    double Bound(const vector<double>& sums, const vector<size_t>& begin, int digit, int row,
+                 size_t remaining) const;
+};
+
+/**
+ * One measurement, printed as it is taken and written to the JSON report.
+ */
+struct BenchResult {
+    string name;
+    double value;
+    string unit;
+};
+
+// Every measurement of this run, in the order they were taken
+vector<BenchResult> results;
+
+// Forward declaration of local helper functions
+void Record(const string& name, double value, const string& unit);
+int WriteJson(const string& fileName, const string& trainFile, const string& testFile);
+void BenchmarkOperations(const string& trainFile, const string& testFile, vector<naivebayes::Sample>& samples);
+void BenchmarkScaled(const string& trainFile, const string& testFile, size_t scale);
+size_t WriteSyntheticFile(const string& trainFile, size_t scale, const string& fileName);
+vector<naivebayes::Sample> ReadSamples(const string& fileName);
+double NanosecondsSince(steady_clock::time_point start);
+void BenchmarkParsers(const string& fileName);
+void BenchmarkShades(const string& trainFile, const string& testFile, int numShades);
+void BenchmarkFixedModel(naivebayes::Model& model, const vector<naivebayes::Sample>& samples);
+void BenchmarkPixelSelection(const string& trainFile, vector<naivebayes::Sample>& samples);
+void BenchmarkPruning(naivebayes::Model& model, const vector<naivebayes::Sample>& samples);
+void BenchmarkAllocations(const string& trainFile, const string& testFile);
+void BenchmarkLogging(naivebayes::Model& model);
+size_t ServeAllocations(naivebayes::ClassificationServer& server, const string& requestFile);
+naivebayes::Scorer BuildScorer(naivebayes::Model& model);
+
+const int kRounds = 5;
+
+/**
+ * Usage: naive-bayes-bench [training file] [test file] [--json report.json] [--scales 10,100,1000]
+ * Every result is printed; with --json they are also written to a report that
+ * can be compared across releases. --scales lists how many times larger than
+ * the training file the synthetic datasets are, 0 to skip them.
+ */
+int main(int argc, char* argv[]) {
+    string trainFile = "tests/trainingimagesandlabels.txt";
+    string testFile = "tests/testimagesandlabels.txt";
+    string jsonFile;
+    vector<size_t> scales = {10, 100};
+    size_t positional = 0;
+    for (int i = 1; i < argc; i++) {
+        string argument = argv[i];
+        if (argument == "--json" && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (argument == "--scales" && i + 1 < argc) {
+            scales.clear();
+            std::istringstream list(argv[++i]);
+            string scale;
+            while (getline(list, scale, ',')) {
+                if (std::stoul(scale) > 0) {
+                    scales.push_back(std::stoul(scale));
+                }
+            }
+        } else if (positional == 0) {
+            trainFile = argument;
+            positional++;
+        } else {
+            testFile = argument;
+            positional++;
+        }
+    }
+
+    naivebayes::Model model;
+    model.BuildModel(trainFile);
+    vector<naivebayes::Sample> samples = ReadSamples(testFile);
+    if (model.GetSampleLength() < 0 || samples.empty()) {
+        cout << "Benchmark needs a valid training file and test file" << endl;
+        return 1;
+    }
+    ProductScorer product(model);
+
+    // Warm up both paths and check that they agree
+    size_t agree = 0;
+    size_t underflows = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        bool underflow = false;
+        int expected = product.Score(samples[i], underflow);
+        if (underflow) {
+            underflows++;
+        } else if (model.CalculateClassification(samples[i]) == expected) {
+            agree++;
+        }
+    }
+
+    // Sink for results so the timed loops cannot be optimized away
+    volatile int sink = 0;
+    steady_clock::time_point start = steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            bool underflow = false;
+            sink = sink + product.Score(samples[i], underflow);
+        }
+    }
+    double product_ns = NanosecondsSince(start) / (kRounds * samples.size());
+
+    start = steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            sink = sink + model.CalculateClassification(samples[i]);
+        }
+    }
+    double log_ns = NanosecondsSince(start) / (kRounds * samples.size());
+
+    Record("test_samples", samples.size(), "samples");
+    Record("pixel_storage", samples[0].GetPackedPixels().size() * sizeof(uint64_t), "bytes/sample");
+    Record("product_scorer_underflows", underflows, "samples");
+    Record("product_scorer_agreement", agree * 1.0 / (samples.size() - underflows), "fraction");
+    Record("product_scorer", product_ns, "ns/sample");
+    Record("log_space_scorer", log_ns, "ns/sample");
+
+    BenchmarkOperations(trainFile, testFile, samples);
+    BenchmarkFixedModel(model, samples);
+    BenchmarkPruning(model, samples);
+    BenchmarkPixelSelection(trainFile, samples);
+    BenchmarkAllocations(trainFile, testFile);
+    BenchmarkLogging(model);
+    BenchmarkShades(trainFile, testFile, 3);
+    BenchmarkParsers(trainFile);
+    for (size_t i = 0; i < scales.size(); i++) {
+        BenchmarkScaled(trainFile, testFile, scales[i]);
+    }
+    if (jsonFile != "") {
+        return WriteJson(jsonFile, trainFile, testFile) ? 0 : 1;
+    }
+    return 0;
+}
+
+void BenchmarkOperations(const string& trainFile, const string& testFile, vector<naivebayes::Sample>& samples) {
+    naivebayes::Model model;
+    steady_clock::time_point start = steady_clock::now();
+    model.BuildModel(trainFile);
+    Record("build_model", NanosecondsSince(start) * 1e-6, "ms");
+
+    const string textFile = "naive-bayes-bench-model.txt";
+    const string binaryFile = "naive-bayes-bench-model.bin";
+    start = steady_clock::now();
+    model.Save(textFile);
+    Record("save_text", NanosecondsSince(start) * 1e-6, "ms");
+    start = steady_clock::now();
+    model.Save(binaryFile, naivebayes::kBinaryModel);
+    Record("save_binary", NanosecondsSince(start) * 1e-6, "ms");
+
+    {
+        // Scoped so the mapping is gone before the files are removed
+        naivebayes::Model loaded;
+        start = steady_clock::now();
+        loaded.Load(textFile);
+        Record("load_text", NanosecondsSince(start) * 1e-6, "ms");
+        start = steady_clock::now();
+        loaded.Load(binaryFile);
+        Record("load_binary", NanosecondsSince(start) * 1e-6, "ms");
+        start = steady_clock::now();
+        loaded.Map(binaryFile);
+        Record("map_binary", NanosecondsSince(start) * 1e-6, "ms");
+    }
+    std::remove(textFile.c_str());
+    std::remove(binaryFile.c_str());
+
+    // Single sample latency, each call timed on its own
+    vector<double> latencies;
+    volatile int sink = 0;
+    for (int round = 0; round < kRounds; round++) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            start = steady_clock::now();
+            sink = sink + model.CalculateClassification(samples[i]);
+            latencies.push_back(NanosecondsSince(start));
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    Record("classify_sample_p50", latencies[latencies.size() / 2], "ns");
+    Record("classify_sample_p99", latencies[latencies.size() * 99 / 100], "ns");
+
+    size_t num_threads = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+    double digit_accuracy[10] = {0};
+    start = steady_clock::now();
+    double accuracy = model.Classify(testFile, digit_accuracy);
+    Record("classify_file", samples.size() / (NanosecondsSince(start) * 1e-9), "samples/s");
+    Record("accuracy", accuracy, "fraction");
+    if (num_threads > 1) {
+        start = steady_clock::now();
+        model.Classify(testFile, digit_accuracy, num_threads);
+        Record("classify_file_threads_" + std::to_string(num_threads),
+               samples.size() / (NanosecondsSince(start) * 1e-9), "samples/s");
+    }
+
+    // The same operations with every phase timed and every latency recorded
+    naivebayes::Metrics::SetEnabled(true);
+    naivebayes::Model measured;
+    start = steady_clock::now();
+    measured.BuildModel(trainFile);
+    Record("build_model_with_metrics", NanosecondsSince(start) * 1e-6, "ms");
+    start = steady_clock::now();
+    measured.Classify(testFile, digit_accuracy);
+    Record("classify_file_with_metrics", samples.size() / (NanosecondsSince(start) * 1e-9), "samples/s");
+    start = steady_clock::now();
+    for (size_t i = 0; i < samples.size(); i++) {
+        sink = sink + measured.CalculateClassification(samples[i]);
+    }
+    Record("classify_sample_with_metrics", NanosecondsSince(start) / samples.size(), "ns");
+    naivebayes::Metrics::SetEnabled(false);
+    naivebayes::Metrics::Global().Reset();
+}
+
+void BenchmarkScaled(const string& trainFile, const string& testFile, size_t scale) {
+    string fileName = "naive-bayes-bench-" + std::to_string(scale) + "x.txt";
+    size_t count = WriteSyntheticFile(trainFile, scale, fileName);
+    if (count == 0) {
+        cout << "Could not write synthetic dataset: " << fileName << endl;
+        return;
+    }
+    naivebayes::SampleReader reader;
+    reader.Open(fileName);
+    double megabytes = reader.GetSize() * 1e-6;
+    string prefix = "synthetic_" + std::to_string(scale) + "x_";
+    Record(prefix + "samples", count, "samples");
+
+    size_t num_threads = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+    naivebayes::Model model;
+    steady_clock::time_point start = steady_clock::now();
+    model.BuildModel(fileName, num_threads);
+    double seconds = NanosecondsSince(start) * 1e-9;
+    Record(prefix + "build_model", count / seconds, "samples/s");
+    Record(prefix + "build_model_bandwidth", megabytes / seconds, "MB/s");
+
+    double digit_accuracy[10] = {0};
+    start = steady_clock::now();
+    model.Classify(fileName, digit_accuracy, num_threads);
+    Record(prefix + "classify_file", count / (NanosecondsSince(start) * 1e-9), "samples/s");
+    Record(prefix + "test_accuracy", model.Classify(testFile, digit_accuracy), "fraction");
+    std::remove(fileName.c_str());
+}
+
+size_t WriteSyntheticFile(const string& trainFile, size_t scale, const string& fileName) {
+    naivebayes::Model model;
+    model.BuildModel(trainFile);
+    ofstream my_file(fileName);
+    if (model.GetSampleLength() < 0 || !my_file.is_open()) {
+        return 0;
+    }
+    // Drawn from the model of the training file, seeded so runs compare
+    naivebayes::SampleGenerator generator(model, 12345);
+    size_t count = model.GetSampleTotals() * scale;
+    naivebayes::Sample sample;
+    for (size_t i = 0; i < count; i++) {
+        generator.Next(sample);
+        naivebayes::WriteSample(sample, naivebayes::kAsciiSamples, my_file);
+    }
+    return my_file.good() ? count : 0;
+}
+
+void Record(const string& name, double value, const string& unit) {
+    BenchResult result = {name, value, unit};
+    results.push_back(result);
+    naivebayes::Logger::Global().Flush();
+    cout << name << ": " << value << " " << unit << endl;
+}
+
+// Quotes a string for JSON, escaping the characters that need it
+string JsonString(const string& text) {
+    string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '"' || text[i] == '\\') {
+            quoted += '\\';
+        }
+        quoted += text[i];
+    }
+    return quoted + "\"";
+}
+
+int WriteJson(const string& fileName, const string& trainFile, const string& testFile) {
+    ofstream my_file(fileName);
+    if (!my_file.is_open()) {
+        cout << "Cannot open file for writing: " << fileName << endl;
+        return 0;
+    }
+#if defined(NDEBUG)
+    bool optimized = true;
+#else
+    bool optimized = false;
+#endif
+    my_file.precision(17);
+    my_file << "{\n";
+    my_file << "  \"benchmark\": \"naive-bayes-bench\",\n";
+    my_file << "  \"optimized\": " << (optimized ? "true" : "false") << ",\n";
+    my_file << "  \"train_file\": " << JsonString(trainFile) << ",\n";
+    my_file << "  \"test_file\": " << JsonString(testFile) << ",\n";
+    my_file << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        my_file << "    {\"name\": " << JsonString(results[i].name) << ", \"value\": " << results[i].value
+                << ", \"unit\": " << JsonString(results[i].unit) << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    my_file << "  ]\n";
+    my_file << "}\n";
+    cout << "Wrote benchmark report: " << fileName << endl;
+    return 1;
+}
+
+void BenchmarkFixedModel(naivebayes::Model& model, const vector<naivebayes::Sample>& samples) {
+    int num_pixels = model.GetSampleLength();
+    naivebayes::Scorer scorer = BuildScorer(model);
+    std::shared_ptr<const naivebayes::FixedModelBase> fixed =
+            naivebayes::MakeFixedModel(num_pixels, 2, scorer.GetBlankScores(), scorer.GetDeltas());
+    if (!fixed) {
+        cout << "No FixedModel for " << num_pixels << "x" << num_pixels << " samples" << endl;
+        return;
+    }
+
+    volatile int sink = 0;
+    double scores[naivebayes::Scorer::kClassStride];
+    steady_clock::time_point start = steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            sink = sink + scorer.Score(samples[i], scores);
+        }
+    }
+    double runtime_ns = NanosecondsSince(start) / (kRounds * samples.size());
+
+    start = steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            sink = sink + fixed->Score(samples[i], scores);
+        }
+    }
+    double fixed_ns = NanosecondsSince(start) / (kRounds * samples.size());
+    Record("runtime_sized_scorer", runtime_ns, "ns/sample");
+    Record("fixed_model_scorer", fixed_ns, "ns/sample");
+}
+
+void BenchmarkPruning(naivebayes::Model& model, const vector<naivebayes::Sample>& samples) {
+    naivebayes::Scorer scorer = BuildScorer(model);
+    PruningScorer pruning(scorer);
+    size_t num_pixels = model.GetSampleLength();
+    size_t shaded = 0;
+    size_t full_rows = 0;
+    size_t pruned_rows = 0;
+    size_t agree = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        // Full scoring adds the deltas of the shaded pixels, up to the row of the last one
+        const vector<uint64_t>& words = samples[i].GetPackedPixels();
+        size_t last_bit = 0;
+        for (size_t w = 0; w < words.size(); w++) {
+            for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+                last_bit = w * naivebayes::Sample::kWordBits + naivebayes::CountTrailingZeros(bits);
+                shaded++;
+            }
+        }
+        full_rows += last_bit / num_pixels + 1;
+        size_t rows = 0;
+        agree += pruning.Score(samples[i], rows) == model.Predict(samples[i]).GetValue();
+        pruned_rows += rows;
+    }
+
+    volatile int sink = 0;
+    size_t rows = 0;
+    steady_clock::time_point start = steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            sink = sink + pruning.Score(samples[i], rows);
+        }
+    }
+    double pruning_ns = NanosecondsSince(start) / (kRounds * samples.size());
+    Record("full_scoring_shaded_pixels", shaded * 1.0 / samples.size(), "pixels/sample");
+    Record("full_scoring_rows", full_rows * 1.0 / samples.size(), "rows/sample");
+    Record("pruning_rows_visited", pruned_rows * 1.0 / samples.size(), "rows/sample");
+    Record("pruning_pixels_visited", pruned_rows * num_pixels * 1.0 / samples.size(), "pixels/sample");
+    Record("pruning_agreement", agree * 1.0 / samples.size(), "fraction");
+    Record("pruning_scorer", pruning_ns, "ns/sample");
+}
+
+void BenchmarkPixelSelection(const string& trainFile, vector<naivebayes::Sample>& samples) {
+    naivebayes::Model model;
+    model.BuildModel(trainFile);
+    size_t pixel_count = model.GetSampleLength() * model.GetSampleLength();
+    // All pixels, then a half, a quarter and an eighth of them
+    for (size_t kept = pixel_count; kept >= pixel_count / 8; kept /= 2) {
+        model.SelectPixels(kept);
+        size_t num_selected = kept < pixel_count ? kept : 0;
+        naivebayes::ModelFileLayout layout = naivebayes::GetModelFileLayout(
+                model.GetSampleLength(), 2, 10, naivebayes::Scorer::kClassStride, false, num_selected);
+
+        volatile int sink = 0;
+        size_t correct = 0;
+        steady_clock::time_point start = steady_clock::now();
+        for (int round = 0; round < kRounds; round++) {
+            for (size_t i = 0; i < samples.size(); i++) {
+                int digit = model.CalculateClassification(samples[i]);
+                correct += digit == samples[i].GetDigit();
+                sink = sink + digit;
+            }
+        }
+        double selected_ns = NanosecondsSince(start) / (kRounds * samples.size());
+        string prefix = "selected_" + std::to_string(kept) + "_pixels_";
+        Record(prefix + "scorer", selected_ns, "ns/sample");
+        Record(prefix + "accuracy", correct * 1.0 / (kRounds * samples.size()), "fraction");
+        Record(prefix + "binary_model", layout.size, "bytes");
+    }
+}
+
+naivebayes::Scorer BuildScorer(naivebayes::Model& model) {
+    int num_pixels = model.GetSampleLength();
+    double prior[10];
+    vector<double> likelihood;
+    for (int c = 0; c < 10; c++) {
+        prior[c] = model.GetPrior(c);
+        for (int v = 0; v < 2; v++) {
+            for (int r = 0; r < num_pixels; r++) {
+                for (int col = 0; col < num_pixels; col++) {
+                    likelihood.push_back(model.GetLikelihood(c, v, r, col));
+                }
+            }
+        }
+    }
+    naivebayes::Scorer scorer;
+    scorer.Build(prior, likelihood.data(), num_pixels, 2);
+    return scorer;
+}
+
+void BenchmarkAllocations(const string& trainFile, const string& testFile) {
+    naivebayes::Model model;
+    model.BuildModel(trainFile);
+    naivebayes::SampleReader reader;
+    if (model.GetSampleLength() < 0 || !reader.Open(testFile)) {
+        return;
+    }
+    // Every loop runs once to warm up, then the allocations of a second pass are counted
+    naivebayes::Sample sample;
+    size_t count = 0;
+    size_t counted = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        ifstream my_file(testFile);
+        counted = allocations;
+        count = 0;
+        while (my_file >> sample, sample.GetSampleLength() >= 0) {
+            count++;
+        }
+        counted = allocations - counted;
+    }
+    Record("allocations_istream_parser", counted * 1.0 / count, "allocations/sample");
+
+    for (int pass = 0; pass < 2; pass++) {
+        naivebayes::SampleReader part = reader;
+        counted = allocations;
+        while (part.Next(sample)) {
+        }
+        counted = allocations - counted;
+    }
+    Record("allocations_mapped_reader", counted * 1.0 / count, "allocations/sample");
+
+    naivebayes::Model trained;
+    for (int pass = 0; pass < 2; pass++) {
+        naivebayes::SampleReader part = reader;
+        counted = allocations;
+        while (part.Next(sample)) {
+            trained.Train(sample);
+        }
+        counted = allocations - counted;
+    }
+    Record("allocations_train", counted * 1.0 / count, "allocations/sample");
+
+    // Online learning: every prediction follows a training step, so it refreshes the class just trained
+    double online_ns = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        naivebayes::SampleReader part = reader;
+        counted = allocations;
+        steady_clock::time_point start = steady_clock::now();
+        while (part.Next(sample)) {
+            trained.Train(sample);
+            trained.CalculateClassification(sample);
+        }
+        online_ns = NanosecondsSince(start) / count;
+        counted = allocations - counted;
+    }
+    Record("allocations_online", counted * 1.0 / count, "allocations/sample");
+    Record("online_train_predict", online_ns, "ns/sample");
+
+    volatile int sink = 0;
+    double log_posteriors[10];
+    int top[3];
+    for (int loop = 0; loop < 2; loop++) {
+        for (int pass = 0; pass < 2; pass++) {
+            naivebayes::SampleReader part = reader;
+            counted = allocations;
+            while (part.Next(sample)) {
+                if (loop == 1) {
+                    sink = sink + model.CalculatePosteriors(sample, log_posteriors, top, 3).GetValue();
+                } else {
+                    sink = sink + model.CalculateClassification(sample);
+                }
+            }
+            counted = allocations - counted;
+        }
+        const char* names[] = {"allocations_classify", "allocations_posteriors"};
+        Record(names[loop], counted * 1.0 / count, "allocations/sample");
+    }
+
+    naivebayes::SampleGenerator generator(model, 1);
+    generator.Next(sample);
+    counted = allocations;
+    for (size_t i = 0; i < count; i++) {
+        generator.Next(sample);
+    }
+    counted = allocations - counted;
+    Record("allocations_generator", counted * 1.0 / count, "allocations/sample");
+
+#if !defined(_WIN32)
+    // Setting up a connection allocates, so the steady state is the difference
+    // between serving the test file once and serving it three times
+    const string onceFile = "naive-bayes-bench-requests-1.bin";
+    const string thriceFile = "naive-bayes-bench-requests-3.bin";
+    ofstream once(onceFile, std::ios::binary);
+    ofstream thrice(thriceFile, std::ios::binary);
+    for (int copy = 0; copy < 3; copy++) {
+        naivebayes::SampleReader part = reader;
+        while (part.Next(sample)) {
+            if (copy == 0) {
+                naivebayes::WriteSample(sample, naivebayes::kPackedSamples, once);
+            }
+            naivebayes::WriteSample(sample, naivebayes::kPackedSamples, thrice);
+        }
+    }
+    once.close();
+    thrice.close();
+    naivebayes::ClassificationServer server(model, naivebayes::kPackedRequests);
+    ServeAllocations(server, thriceFile);
+    size_t once_allocations = ServeAllocations(server, onceFile);
+    size_t thrice_allocations = ServeAllocations(server, thriceFile);
+    Record("allocations_server", (thrice_allocations - std::min(once_allocations, thrice_allocations)) * 0.5 / count,
+           "allocations/request");
+    remove(onceFile.c_str());
+    remove(thriceFile.c_str());
+#endif
+}
+
+void BenchmarkLogging(naivebayes::Model& model) {
+    // Every sample of the wrong size is reported, the output itself is discarded
+    naivebayes::Sample wrong_size(model.GetSampleLength() / 2);
+    std::ostream discard(nullptr);
+    naivebayes::Logger& logger = naivebayes::Logger::Global();
+    logger.SetOutput(&discard);
+    const size_t count = 100000;
+    volatile int sink = 0;
+    naivebayes::LogLevel levels[] = {naivebayes::kLogInfo, naivebayes::kLogOff};
+    const char* names[] = {"invalid_sample_logged", "invalid_sample_quiet"};
+    for (int i = 0; i < 2; i++) {
+        naivebayes::Logger::SetLevel(levels[i]);
+        steady_clock::time_point start = steady_clock::now();
+        for (size_t n = 0; n < count; n++) {
+            sink = sink + model.CalculateClassification(wrong_size);
+        }
+        logger.Flush();
+        Record(names[i], NanosecondsSince(start) / count, "ns/sample");
+    }
+    naivebayes::Logger::SetLevel(naivebayes::kLogInfo);
+    logger.SetOutput(&cout);
+}
+
+size_t ServeAllocations(naivebayes::ClassificationServer& server, const string& requestFile) {
+#if defined(_WIN32)
+    return 0;
+#else
+    int input = open(requestFile.c_str(), O_RDONLY);
+    int output = open("/dev/null", O_WRONLY);
+    size_t counted = allocations;
+    server.Serve(input, output);
+    counted = allocations - counted;
+    close(input);
+    close(output);
+    return counted;
+#endif
+}
+
+void BenchmarkShades(const string& trainFile, const string& testFile, int numShades) {
+    naivebayes::Model model(numShades);
+    model.BuildModel(trainFile);
+    naivebayes::SampleReader reader;
+    if (model.GetSampleLength() < 0 || !reader.Open(testFile, numShades)) {
+        return;
+    }
+    vector<naivebayes::Sample> samples;
+    naivebayes::Sample sample;
+    while (reader.Next(sample)) {
+        samples.push_back(sample);
+    }
+
+    volatile int sink = 0;
+    size_t correct = 0;
+    steady_clock::time_point start = steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            int digit = model.CalculateClassification(samples[i]);
+            correct += digit == samples[i].GetDigit();
+            sink = sink + digit;
+        }
+    }
+    double shades_ns = NanosecondsSince(start) / (kRounds * samples.size());
+    string prefix = std::to_string(numShades) + "_shades_";
+    Record(prefix + "scorer", shades_ns, "ns/sample");
+    Record(prefix + "accuracy", correct * 1.0 / (kRounds * samples.size()), "fraction");
+}
+
+void BenchmarkParsers(const string& fileName) {
+    naivebayes::SampleReader reader;
+    if (!reader.Open(fileName)) {
+        return;
+    }
+    double megabytes = reader.GetSize() * 1e-6 * kRounds;
+
+    size_t istream_samples = 0;
+    steady_clock::time_point start = steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        ifstream my_file(fileName);
+        naivebayes::Sample sample;
+        while (!my_file.eof()) {
+            my_file >> sample;
+            if (sample.GetSampleLength() == sample.kSampleIgnore) {
+                break;
+            }
+            istream_samples++;
+        }
+    }
+    double istream_seconds = NanosecondsSince(start) * 1e-9;
+
+    size_t mapped_samples = 0;
+    start = steady_clock::now();
+    for (int round = 0; round < kRounds; round++) {
+        naivebayes::SampleReader mapped;
+        mapped.Open(fileName);
+        naivebayes::Sample sample;
+        while (mapped.Next(sample)) {
+            mapped_samples++;
+        }
+    }
+    double mapped_seconds = NanosecondsSince(start) * 1e-9;
+
+    Record("istream_parser_samples", istream_samples / kRounds, "samples");
+    Record("mapped_reader_samples", mapped_samples / kRounds, "samples");
+    Record("istream_parser", megabytes / istream_seconds, "MB/s");
+    Record("mapped_reader", megabytes / mapped_seconds, "MB/s");
+}
+
+ProductScorer::ProductScorer(naivebayes::Model& model) {
+    num_pixels = model.GetSampleLength();
+    for (int c = 0; c < 10; c++) {
+        prior[c] = model.GetPrior(c);
+        for (int v = 0; v < 2; v++) {
+            likelihood[c][v].resize(num_pixels * num_pixels);
+            for (int r = 0; r < num_pixels; r++) {
+                for (int col = 0; col < num_pixels; col++) {
+                    likelihood[c][v][r * num_pixels + col] = model.GetLikelihood(c, v, r, col);
+                }
+            }
+        }
+    }
+}
+
+int ProductScorer::Score(naivebayes::Sample& sample, bool& underflow) const {
+    double p_bayes[10];
+    for (int i = 0; i < 10; i++) {
+        p_bayes[i] = prior[i];
+        for (int r = 0; r < num_pixels; r++) {
+            for (int col = 0; col < num_pixels; col++) {
+                p_bayes[i] *= likelihood[i][sample.GetPixel(r, col)][r * num_pixels + col];
+            }
+        }
+    }
+    int bayes_digit = 0;
+    for (int j = 0; j < 10; j++) {
+        if (p_bayes[j] > p_bayes[bayes_digit]) {
+            bayes_digit = j;
+        }
+    }
+    underflow = !std::isnormal(p_bayes[bayes_digit]);
+    return bayes_digit;
+}
+
+PruningScorer::PruningScorer(const naivebayes::Scorer& scorer) {
+    num_pixels = scorer.GetSampleLength();
+    size_t pixel_count = num_pixels * num_pixels;
+    const double* table = scorer.GetDeltas();
+    deltas.assign(table, table + pixel_count * naivebayes::Scorer::kClassStride);
+    for (int c = 0; c < 10; c++) {
+        blank_scores[c] = scorer.GetBlankScores()[c];
+        for (int r = 0; r <= num_pixels; r++) {
+            vector<double> ahead;
+            for (size_t p = r * num_pixels; p < pixel_count; p++) {
+                ahead.push_back(deltas[p * naivebayes::Scorer::kClassStride + c]);
+            }
+            std::sort(ahead.begin(), ahead.end());
+            // Set bits beyond the positive deltas add nothing to the best case, and
+            // beyond the negative ones nothing to the worst case
+            upper_begin.push_back(upper.size());
+            upper.push_back(0);
+            for (size_t k = ahead.size(); k > 0 && ahead[k - 1] > 0; k--) {
+                upper.push_back(upper.back() + ahead[k - 1]);
+            }
+            lower_begin.push_back(lower.size());
+            lower.push_back(0);
+            for (size_t k = 0; k < ahead.size() && ahead[k] < 0; k++) {
+                lower.push_back(lower.back() + ahead[k]);
+            }
+        }
+    }
+    upper_begin.push_back(upper.size());
+    lower_begin.push_back(lower.size());
+}
+
+double PruningScorer::Bound(const vector<double>& sums, const vector<size_t>& begin, int digit, int row,
+                            size_t remaining) const {
+    size_t b = digit * (num_pixels + 1) + row;
+    return sums[begin[b] + std::min(remaining, begin[b + 1] - begin[b] - 1)];
+}
+
+int PruningScorer::Score(const naivebayes::Sample& sample, size_t& rows_visited) const {
+    const vector<uint64_t>& words = sample.GetPackedPixels();
+    size_t remaining = 0;
+    for (size_t w = 0; w < words.size(); w++) {
+        for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+            remaining++;
+        }
+    }
+    double scores[10];
+    bool alive[10];
+    int num_alive = 10;
+    for (int c = 0; c < 10; c++) {
+        scores[c] = blank_scores[c];
+        alive[c] = true;
+    }
+    size_t w = 0;
+    uint64_t bits = words.empty() ? 0 : words[0];
+    rows_visited = 0;
+    for (int r = 0; r < num_pixels && remaining > 0 && num_alive > 1; r++) {
+        size_t row_end = (r + 1) * num_pixels;
+        while (true) {
+            while (bits == 0 && ++w < words.size()) {
+                bits = words[w];
+            }
+            if (bits == 0) {
+                break;
+            }
+            size_t bit = w * naivebayes::Sample::kWordBits + naivebayes::CountTrailingZeros(bits);
+            if (bit >= row_end) {
+                break;
+            }
+            const double* row = &deltas[bit * naivebayes::Scorer::kClassStride];
+            for (int c = 0; c < 10; c++) {
+                scores[c] += alive[c] ? row[c] : 0;
+            }
+            remaining--;
+            bits &= bits - 1;
+        }
+        rows_visited = r + 1;
+        double best_worst = -INFINITY;
+        for (int c = 0; c < 10; c++) {
+            if (alive[c]) {
+                best_worst = std::max(best_worst, scores[c] + Bound(lower, lower_begin, c, r + 1, remaining));
+            }
+        }
+        for (int c = 0; c < 10; c++) {
+            if (alive[c] && scores[c] + Bound(upper, upper_begin, c, r + 1, remaining) < best_worst) {
+                alive[c] = false;
+                num_alive--;
+            }
+        }
+    }
+    // Either one class is left, or no set bits are and the scores are final; ties go to the lower digit
+    int digit = -1;
+    for (int c = 0; c < 10; c++) {
+        if (alive[c] && (digit < 0 || scores[c] > scores[digit])) {
+            digit = c;
+        }
+    }
+    return digit;
+}
+
+vector<naivebayes::Sample> ReadSamples(const string& fileName) {
+    vector<naivebayes::Sample> samples;
+    ifstream my_file(fileName);
+    naivebayes::Sample sample;
+    while (my_file.is_open() && !my_file.eof()) {
+        my_file >> sample;
+        if (sample.GetSampleLength() < 0) {
+            break;
+        }
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+double NanosecondsSince(steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(steady_clock::now() - start).count();
+}
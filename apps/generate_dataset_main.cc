@@ -0,0 +1,121 @@
+#include <fstream>
+#include <iostream>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <core/logger.h>
+#include <core/model.h>
+#include <core/sample_generator.h>
+namespace options = boost::program_options;
+
+// Forward declaration of local helper function
+int ProcessArguments(int argc, char* argv[], string& trainFile, string& loadFile, string& outputFile, size_t& count,
+                     uint64_t& seed, int& numShades, naivebayes::SampleFormat& format);
+
+/**
+ * Writes synthetic labelled samples drawn from a model, e.g.
+ *   generate-dataset --train tests/trainingimagesandlabels.txt --count 5000000 --output big.txt
+ * The model comes from a training file or a saved model file. Samples are
+ * streamed to the output as they are drawn, so the file may be far larger than
+ * memory, and the same seed always writes the same file.
+ */
+int main(int argc, char* argv[]) {
+    string trainFile;
+    string loadFile;
+    string outputFile;
+    size_t count = 0;
+    uint64_t seed = 1;
+    int numShades = 2;
+    naivebayes::SampleFormat format = naivebayes::kAsciiSamples;
+    if (ProcessArguments(argc, argv, trainFile, loadFile, outputFile, count, seed, numShades, format) != 0) {
+        return 1;
+    }
+    // When the samples go to stdout it only carries them, every message goes to stderr
+    std::streambuf* coutBuffer = cout.rdbuf();
+    std::ostream standardOutput(coutBuffer);
+    std::ofstream outputStream;
+    std::ostream* output = &standardOutput;
+    if (outputFile == "" || outputFile == "-") {
+        cout.rdbuf(std::cerr.rdbuf());
+        naivebayes::Logger::Global().SetOutput(&std::cerr);
+    } else {
+        outputStream.open(outputFile, std::ios::binary);
+        if (!outputStream.is_open()) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, "Cannot open file for writing: " << outputFile);
+            return 1;
+        }
+        output = &outputStream;
+    }
+
+    naivebayes::Model model(numShades);
+    if (loadFile != "") {
+        model.Load(loadFile);
+    } else if (trainFile != "") {
+        model.BuildModel(trainFile);
+    }
+    naivebayes::SampleGenerator generator(model, seed);
+    naivebayes::Sample sample;
+    int status = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!generator.Next(sample)) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, "Cannot generate samples without a valid model");
+            status = 1;
+            break;
+        }
+        if (!naivebayes::WriteSample(sample, format, *output)) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, "Cannot write samples");
+            status = 1;
+            break;
+        }
+    }
+    output->flush();
+    naivebayes::Logger::Global().Flush();
+    cout.rdbuf(coutBuffer);
+    return status;
+}
+
+int ProcessArguments(int argc, char* argv[], string& trainFile, string& loadFile, string& outputFile, size_t& count,
+                     uint64_t& seed, int& numShades, naivebayes::SampleFormat& format) {
+    options::options_description desc("Allowed options");
+    desc.add_options()
+            ("help", "produce help message")
+            ("train", options::value<string>(), "Training data file to build the model the samples are drawn from")
+            ("load", options::value<string>(), "Model file the samples are drawn from")
+            ("count", options::value<size_t>(), "Number of samples to write")
+            ("seed", options::value<uint64_t>(), "Seed of the random generator, 1 by default")
+            ("output", options::value<string>(), "File to write, stdout if not given")
+            ("packed", "Write the packed binary sample format instead of ASCII")
+            ("shades", options::value<int>(), "Number of shade levels to train with")
+            ;
+
+    options::variables_map vm;
+    options::store(options::parse_command_line(argc, argv, desc), vm);
+    options::notify(vm);
+
+    if (vm.count("help") || (!vm.count("train") && !vm.count("load"))) {
+        cout << desc << endl;
+        return 1;
+    }
+    if (vm.count("train")) {
+        trainFile = vm["train"].as<string>();
+    }
+    if (vm.count("load")) {
+        loadFile = vm["load"].as<string>();
+    }
+    if (vm.count("count")) {
+        count = vm["count"].as<size_t>();
+    }
+    if (vm.count("seed")) {
+        seed = vm["seed"].as<uint64_t>();
+    }
+    if (vm.count("output")) {
+        outputFile = vm["output"].as<string>();
+    }
+    if (vm.count("packed")) {
+        format = naivebayes::kPackedSamples;
+    }
+    if (vm.count("shades")) {
+        numShades = vm["shades"].as<int>();
+    }
+    return 0;
+}
@@ -1,50 +1,269 @@
+#include <csignal>
 #include <iostream>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
+#include <core/classification_server.h>
+#include <core/cross_validation.h>
 #include <core/digit_classifier.h>
+#include <core/logger.h>
+#include <core/metrics.h>
+#include <core/sample_index.h>
 namespace options = boost::program_options;
 
+// Server that a SIGINT or SIGTERM shuts down
+naivebayes::ClassificationServer* activeServer = nullptr;
+
+void StopServer(int) {
+    if (activeServer != nullptr) {
+        activeServer->Stop();
+    }
+}
+
 // Forward declaration of local helper function
-int ProcessArguments(int argc, char* argv[], string& trainFile, string& saveFile, string& loadFile, string& classifyFile, int& printModel);
+int ProcessArguments(int argc, char* argv[], string& trainFile, vector<string>& mergeFiles, string& saveFile,
+                     string& loadFile, string& mapFile, string& classifyFile, int& printModel, size_t& numThreads,
+                     int& numShades, naivebayes::ModelFormat& saveFormat, int& serve, string& socketFile,
+                     size_t& batchSize, naivebayes::RequestFormat& requestFormat, size_t& selectPixels,
+                     string& statsFormat, string& logLevel, naivebayes::RecordPolicy& recordPolicy,
+                     string& indexFile, size_t& numFolds, vector<double>& laplaces);
+
+/**
+ * Cross-validates training on a file for every smoothing and prints the
+ * accuracy of every fold and digit.
+ * @return exit status of the program
+ */
+int CrossValidate(const string& trainFile, size_t numFolds, const vector<double>& laplaces, size_t numThreads,
+                  int numShades);
 
 int main(int argc, char* argv[]) {
     string trainFile;
+    vector<string> mergeFiles;
     string saveFile;
     string loadFile;
+    string mapFile;
     string classifyFile;
     int printModel = 0;
-    ProcessArguments(argc, argv, trainFile, saveFile, loadFile, classifyFile, printModel);
-    naivebayes::Model model;
+    size_t numThreads = 1;
+    int numShades = 2;
+    naivebayes::ModelFormat saveFormat = naivebayes::kTextModel;
+    int serve = 0;
+    string socketFile;
+    size_t batchSize = 64;
+    naivebayes::RequestFormat requestFormat = naivebayes::kAsciiRequests;
+    size_t selectPixels = 0;
+    string statsFormat;
+    string logLevel = "info";
+    naivebayes::RecordPolicy recordPolicy = naivebayes::kStopOnBadRecord;
+    string indexFile;
+    size_t numFolds = 0;
+    vector<double> laplaces;
+    ProcessArguments(argc, argv, trainFile, mergeFiles, saveFile, loadFile, mapFile, classifyFile, printModel, numThreads,
+                     numShades, saveFormat, serve, socketFile, batchSize, requestFormat, selectPixels, statsFormat,
+                     logLevel, recordPolicy, indexFile, numFolds, laplaces);
+    const char* levels[] = {"debug", "info", "warning", "error", "off"};
+    int level = 0;
+    while (level <= naivebayes::kLogOff && logLevel != levels[level]) {
+        level++;
+    }
+    if (level > naivebayes::kLogOff) {
+        cout << "Unknown log level: " << logLevel << ", expected debug, info, warning, error or off" << endl;
+        return 1;
+    }
+    naivebayes::Logger::SetLevel(static_cast<naivebayes::LogLevel>(level));
+    if (statsFormat != "" && statsFormat != "json" && statsFormat != "prometheus") {
+        cout << "Unknown stats format: " << statsFormat << ", expected json or prometheus" << endl;
+        return 1;
+    }
+    naivebayes::Metrics::SetEnabled(statsFormat != "");
+    // When serving on stdout it only carries predictions, every message goes to stderr
+    std::streambuf* coutBuffer = cout.rdbuf();
+    if (serve != 0) {
+        cout.rdbuf(std::cerr.rdbuf());
+        naivebayes::Logger::Global().SetOutput(&std::cerr);
+    }
+    if (indexFile != "") {
+        naivebayes::SampleIndex index;
+        naivebayes::Status status = index.Build(indexFile, numShades);
+        if (status.IsOk()) {
+            status = index.Save(naivebayes::SampleIndex::GetSidecarName(indexFile));
+        }
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, status.GetMessage());
+            return 1;
+        }
+        NAIVE_BAYES_LOG(naivebayes::kLogInfo, "Indexed " << index.GetNumRecords() << " samples of file: " << indexFile);
+    }
+    if (numFolds > 0) {
+        int status = CrossValidate(trainFile, numFolds, laplaces, numThreads, numShades);
+        naivebayes::Logger::Global().Flush();
+        return status;
+    }
+    naivebayes::Model model(numShades);
+    if (!laplaces.empty()) {
+        naivebayes::Status status = model.SetLaplace(laplaces[0]);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, status.GetMessage());
+            return 1;
+        }
+    }
     if (trainFile != "") {
-        model.BuildModel(trainFile);
+        naivebayes::Status status = model.TrainFile(trainFile, numThreads, recordPolicy);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, status.GetMessage());
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < mergeFiles.size(); i++) {
+        // Shards are binary models saved with their training counts
+        naivebayes::Model shard;
+        naivebayes::Status status = shard.LoadFile(mergeFiles[i]);
+        if (status.IsOk()) {
+            status = model.Merge(shard);
+        }
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, "Could not merge model file: " << mergeFiles[i] << ": "
+                                                   << status.GetMessage());
+            return 1;
+        }
+    }
+    if (selectPixels > 0) {
+        naivebayes::Status status = model.SelectPixels(selectPixels);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, status.GetMessage());
+            return 1;
+        }
     }
-    if (saveFile != "") {
-        model.Save(saveFile);
+    // The errors are logged by Save, Load and Map
+    if (saveFile != "" && model.Save(saveFile, saveFormat) == 0) {
+        return 1;
     }
-    if (loadFile != "") {
-        model.Load(loadFile);
+    if (loadFile != "" && model.Load(loadFile) == 0) {
+        return 1;
+    }
+    if (mapFile != "" && model.Map(mapFile) == 0) {
+        return 1;
     }
     if (classifyFile != "") {
         double digit_accuracy[10] = {0};
-        model.Classify(classifyFile, digit_accuracy);
+        model.Classify(classifyFile, digit_accuracy, numThreads);
     }
     if (printModel != 0) {
         model.Print();
     }
+    if (serve != 0 || socketFile != "") {
+        naivebayes::ClassificationServer server(model, requestFormat, batchSize);
+        activeServer = &server;
+        signal(SIGINT, StopServer);
+        signal(SIGTERM, StopServer);
+#if !defined(_WIN32)
+        // A client going away must not kill the server
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        if (socketFile != "") {
+            server.ServeSocket(socketFile);
+        } else {
+            server.Serve(0, 1);
+        }
+        server.PrintStats(std::cerr);
+        activeServer = nullptr;
+    }
+    naivebayes::Logger::Global().Flush();
+    cout.rdbuf(coutBuffer);
+    // Printed last so that it can be cut from the rest of the output, on stderr when stdout carries predictions
+    std::ostream& statsOutput = serve != 0 ? std::cerr : cout;
+    if (statsFormat == "json") {
+        naivebayes::Metrics::Global().WriteJson(statsOutput);
+    } else if (statsFormat == "prometheus") {
+        naivebayes::Metrics::Global().WritePrometheus(statsOutput);
+    }
 }
 
-int ProcessArguments(int argc, char* argv[], string& trainFile, string& saveFile, string& loadFile, string& classifyFile, int& printModel) {
+int CrossValidate(const string& trainFile, size_t numFolds, const vector<double>& laplaces, size_t numThreads,
+                  int numShades) {
+    if (trainFile == "") {
+        cout << "Cross-validation needs a training file, see --train" << endl;
+        return 1;
+    }
+    naivebayes::CrossValidator validator(numShades);
+    naivebayes::Status status = validator.Open(trainFile, numFolds, numThreads);
+    if (!status.IsOk()) {
+        NAIVE_BAYES_LOG(naivebayes::kLogError, status.GetMessage());
+        return 1;
+    }
+    if (validator.GetSkippedRecords() > 0) {
+        NAIVE_BAYES_LOG(naivebayes::kLogWarning, "Left out " << validator.GetSkippedRecords() << " bad samples");
+    }
+    vector<double> candidates = laplaces.empty() ? vector<double>(1, 1.0) : laplaces;
+    double bestLaplace = candidates[0];
+    double bestAccuracy = -1;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        naivebayes::Result<vector<naivebayes::FoldResult>> folds = validator.Evaluate(candidates[i], numThreads);
+        if (!folds.IsOk()) {
+            NAIVE_BAYES_LOG(naivebayes::kLogError, folds.GetStatus().GetMessage());
+            return 1;
+        }
+        // The report goes to the logger's stream, after everything logged so far
+        naivebayes::Logger::Global().Flush();
+        cout << "Laplace " << candidates[i] << ":" << endl;
+        double mean = 0;
+        for (size_t f = 0; f < folds.GetValue().size(); f++) {
+            const naivebayes::FoldResult& fold = folds.GetValue()[f];
+            cout << "  Fold " << f << ", trained on " << fold.num_trained << " samples, accuracy "
+                 << fold.GetAccuracy() << endl << "   ";
+            for (int d = 0; d < 10; d++) {
+                cout << " " << d << ": " << fold.GetDigitAccuracy(d);
+            }
+            cout << endl;
+            mean += fold.GetAccuracy() / folds.GetValue().size();
+        }
+        cout << "  Mean accuracy " << mean << endl;
+        if (mean > bestAccuracy) {
+            bestAccuracy = mean;
+            bestLaplace = candidates[i];
+        }
+    }
+    if (candidates.size() > 1) {
+        naivebayes::Logger::Global().Flush();
+        cout << "Best laplace " << bestLaplace << ", mean accuracy " << bestAccuracy << endl;
+    }
+    return 0;
+}
+
+int ProcessArguments(int argc, char* argv[], string& trainFile, vector<string>& mergeFiles, string& saveFile,
+                     string& loadFile, string& mapFile, string& classifyFile, int& printModel, size_t& numThreads,
+                     int& numShades, naivebayes::ModelFormat& saveFormat, int& serve, string& socketFile,
+                     size_t& batchSize, naivebayes::RequestFormat& requestFormat, size_t& selectPixels,
+                     string& statsFormat, string& logLevel, naivebayes::RecordPolicy& recordPolicy,
+                     string& indexFile, size_t& numFolds, vector<double>& laplaces) {
     // Booster command line processing
     // Declare the supported options.
     options::options_description desc("Allowed options");
     desc.add_options()
             ("help", "produce help message")
             ("train", options::value<string>(), "Training data file to train model")
+            ("skip-bad-records", "Leave malformed training samples out and count them instead of stopping")
+            ("index", options::value<string>(), "Write the record index sidecar of a sample file, used to split it among threads")
+            ("kfold", options::value<size_t>(), "Cross-validate training on the training file with this many folds")
+            ("laplace", options::value<vector<double>>()->multitoken(),
+                    "Laplace smoothing, 1 by default; with --kfold every value given is cross-validated")
+            ("merge", options::value<vector<string>>()->multitoken(), "Binary model files whose counts are merged into the model")
             ("save", options::value<string>(), "Save model to file")
+            ("binary", "Save model in the binary format")
             ("load", options::value<string>(), "Load model from file")
+            ("map", options::value<string>(), "Memory map a binary model file read-only")
             ("classify", options::value<string>(), "Classify samples in file")
             ("print", "Print model")
+            ("threads", options::value<size_t>(), "Number of worker threads")
+            ("serve", "Classify samples read from stdin, one prediction per line on stdout")
+            ("socket", options::value<string>(), "Classify samples sent to a Unix domain socket")
+            ("batch", options::value<size_t>(), "Largest number of requests answered at once when serving")
+            ("packed", "Requests are in the packed binary sample format")
+            ("shades", options::value<int>(), "Number of shade levels to train with: 2, or 3 to tell '+' from '#'")
+            ("select-pixels", options::value<size_t>(), "Keep only this many pixels, the most informative about the digit")
+            ("stats", options::value<string>()->implicit_value("json"),
+                    "Print phase times, counters and classification latencies at exit: json (default) or prometheus")
+            ("log-level", options::value<string>(), "Least severe messages printed: debug, info (default), warning, error or off")
             ;
 
     options::variables_map vm;
@@ -58,12 +277,18 @@ int ProcessArguments(int argc, char* argv[], string& trainFile, string& saveFile
     if (vm.count("train")) {
         trainFile = vm["train"].as<string>();
     }
+    if (vm.count("merge")) {
+        mergeFiles = vm["merge"].as<vector<string>>();
+    }
     if (vm.count("save")) {
         saveFile = vm["save"].as<string>();
     }
     if (vm.count("load")) {
         loadFile = vm["load"].as<string>();
     }
+    if (vm.count("map")) {
+        mapFile = vm["map"].as<string>();
+    }
     if (vm.count("classify")) {
         classifyFile = vm["classify"].as<string>();
     }
@@ -71,5 +296,48 @@ int ProcessArguments(int argc, char* argv[], string& trainFile, string& saveFile
     if (vm.count("print")) {
         printModel = 1;
     }
+    if (vm.count("binary")) {
+        saveFormat = naivebayes::kBinaryModel;
+    }
+    if (vm.count("skip-bad-records")) {
+        recordPolicy = naivebayes::kSkipBadRecords;
+    }
+    if (vm.count("index")) {
+        indexFile = vm["index"].as<string>();
+    }
+    if (vm.count("kfold")) {
+        numFolds = vm["kfold"].as<size_t>();
+    }
+    if (vm.count("laplace")) {
+        laplaces = vm["laplace"].as<vector<double>>();
+    }
+    if (vm.count("threads")) {
+        numThreads = vm["threads"].as<size_t>();
+    }
+    if (vm.count("shades")) {
+        numShades = vm["shades"].as<int>();
+    }
+    serve = 0;
+    if (vm.count("serve")) {
+        serve = 1;
+    }
+    if (vm.count("socket")) {
+        socketFile = vm["socket"].as<string>();
+    }
+    if (vm.count("batch")) {
+        batchSize = vm["batch"].as<size_t>();
+    }
+    if (vm.count("packed")) {
+        requestFormat = naivebayes::kPackedRequests;
+    }
+    if (vm.count("select-pixels")) {
+        selectPixels = vm["select-pixels"].as<size_t>();
+    }
+    if (vm.count("log-level")) {
+        logLevel = vm["log-level"].as<string>();
+    }
+    if (vm.count("stats")) {
+        statsFormat = vm["stats"].as<string>();
+    }
     return 0;
 }
@@ -0,0 +1,74 @@
+#ifndef NAIVE_BAYES_ALIGNED_ALLOCATOR_H
+#define NAIVE_BAYES_ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace naivebayes {
+    // Cache line size, the alignment of every model table
+    const size_t kTableAlignment = 64;
+
+    /**
+     * Allocator that places std::vector storage on a kTableAlignment boundary.
+     */
+    template <typename T>
+    class AlignedAllocator {
+    public:
+        typedef T value_type;
+
+        AlignedAllocator() {}
+
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U>&) {}
+
+        T* allocate(size_t n) {
+            if (n == 0) {
+                return nullptr;
+            }
+#if defined(_WIN32)
+            void* memory = _aligned_malloc(n * sizeof(T), kTableAlignment);
+            if (memory == nullptr) {
+                throw std::bad_alloc();
+            }
+#else
+            void* memory = nullptr;
+            if (posix_memalign(&memory, kTableAlignment, n * sizeof(T)) != 0) {
+                throw std::bad_alloc();
+            }
+#endif
+            return static_cast<T*>(memory);
+        }
+
+        void deallocate(T* memory, size_t) {
+#if defined(_WIN32)
+            _aligned_free(memory);
+#else
+            free(memory);
+#endif
+        }
+    };
+
+    template <typename T, typename U>
+    bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+        return true;
+    }
+
+    template <typename T, typename U>
+    bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+        return false;
+    }
+
+    /**
+     * A contiguous, cache line aligned table.
+     */
+    template <typename T>
+    using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+}
+
+#endif //NAIVE_BAYES_ALIGNED_ALLOCATOR_H
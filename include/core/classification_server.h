@@ -0,0 +1,201 @@
+#ifndef NAIVE_BAYES_CLASSIFICATION_SERVER_H
+#define NAIVE_BAYES_CLASSIFICATION_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "core/model.h"
+#include "core/sample.h"
+
+namespace naivebayes {
+    /**
+     * Formats of the requests a ClassificationServer reads.
+     *  kAsciiRequests:  samples in the training file format, a label line (any
+     *                   digit, it is only used for the accuracy counters) followed
+     *                   by one line per image row.
+     *  kPackedRequests: one byte label (0-9, or 255 when unknown) followed by the
+     *                   sample's packed pixel words in native byte order, see
+     *                   Sample::GetPackedPixels().
+     * Every request is answered with one line holding the predicted digit, or -1
+     * if the request did not fit the model, in the order the requests came in.
+     * ASCII requests are framed like SampleReader::Read() reads samples: blank
+     * lines between them are passed over, and a malformed request runs to the
+     * next label line, so it is answered once, when that line or the end of the
+     * input arrives.
+     */
+    enum RequestFormat {
+        kAsciiRequests,
+        kPackedRequests
+    };
+
+    // Label byte of a packed request whose digit is not known
+    const unsigned char kUnknownLabel = 255;
+
+    /**
+     * Counters of a ClassificationServer since it was created.
+     */
+    struct ServerStats {
+        size_t requests;
+        size_t batches;
+        // Requests whose label was a digit, and how many of them were predicted right
+        size_t labelled;
+        size_t correct;
+        // Time spent serving connections
+        double seconds;
+        // Microseconds from a request being read to its prediction being written
+        double mean_latency;
+        double p50_latency;
+        double p99_latency;
+        double max_latency;
+    };
+
+    /**
+     * Long running classifier. The model is loaded once; requests are read from
+     * a file descriptor or a Unix domain socket on a reader thread while the
+     * calling thread classifies the previous batch and writes its predictions,
+     * so parsing and classification overlap. A batch is closed when it reaches
+     * the batch size or when no more input is available right away, so a lone
+     * request is answered without waiting for others. At most a few batches are
+     * queued; past that the reader stops reading and the client blocks.
+     */
+    class ClassificationServer {
+    public:
+        /**
+         * Constructor
+         * @param model trained, loaded or mapped model; it must outlive the server
+         * @param format format of the requests
+         * @param max_batch largest number of requests classified and written at once
+         */
+        ClassificationServer(Model& model, RequestFormat format = kAsciiRequests, size_t max_batch = 64);
+
+        /**
+         * This method serves requests from one input until it ends or Stop() is called.
+         * @param input_fd descriptor requests are read from
+         * @param output_fd descriptor predictions are written to
+         * @return 1 on success, 0 on error
+         */
+        int Serve(int input_fd, int output_fd);
+
+        /**
+         * This method listens on a Unix domain socket and serves one connection
+         * after another until Stop() is called.
+         * @param path filesystem path of the socket, replaced if it exists
+         * @return 1 on success, 0 if the socket cannot be set up
+         */
+        int ServeSocket(const std::string& path);
+
+        /**
+         * This method asks Serve() and ServeSocket() to return. It only sets a
+         * flag, so it may be called from a signal handler.
+         */
+        void Stop();
+
+        ServerStats GetStats() const;
+
+        /**
+         * This method prints the latency and throughput counters, after the
+         * messages logged before it.
+         * @param output
+         */
+        void PrintStats(std::ostream& output) const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        // Requests read together, classified and answered together. Batches are
+        // recycled, the first size samples are the requests and the rest are kept
+        // to be refilled by later requests.
+        struct Batch {
+            std::vector<Sample> samples;
+            size_t size;
+            std::vector<Clock::time_point> arrivals;
+            // Set on the last batch of an input
+            bool end;
+        };
+
+        // Batches queued between the reader thread and the classifying thread
+        static const size_t kMaxQueuedBatches = 4;
+        // Queued batches, plus the one being read and the one being answered
+        static const size_t kNumBatches = kMaxQueuedBatches + 2;
+        // Latencies kept for the percentiles, the most recent ones
+        static const size_t kLatencyWindow = 1 << 16;
+
+        Model& model_;
+        // Dimensions of the model, read by the reader thread
+        int sample_length_;
+        int num_shades_;
+        RequestFormat format_;
+        size_t max_batch_;
+        std::atomic<bool> stop_;
+        // Set when the output of the current connection can no longer be written
+        std::atomic<bool> closed_;
+
+        std::mutex queue_mutex_;
+        std::condition_variable queue_changed_;
+        Batch batches_[kNumBatches];
+        // Ring of the indices of queued batches, oldest at queue_head_
+        size_t queue_[kMaxQueuedBatches];
+        size_t queue_head_;
+        size_t queue_size_;
+        // Indices of batches that hold no requests
+        size_t free_batches_[kNumBatches];
+        size_t num_free_;
+        // Packed words of the request being parsed and the predictions of the batch
+        // being answered, kept so that steady state serving does not allocate
+        std::vector<uint64_t> request_words_;
+        std::string answers_;
+
+        ServerStats stats_;
+        double latency_total_;
+        std::vector<double> latencies_;
+        size_t next_latency_;
+
+        /**
+         * This method reads and parses requests on the reader thread and queues them in batches.
+         */
+        void ReadRequests(int input_fd);
+
+        /**
+         * This method finds the end of the first complete request in a buffer.
+         * An ASCII request that is malformed only ends where the next one starts.
+         * @param at_end whether the input has no more data, so an incomplete
+         *               ASCII request takes the rest of the buffer
+         * @return number of bytes of the request, or 0 if it is not complete yet
+         */
+        size_t RequestSize(const char* data, size_t size, bool at_end) const;
+
+        /**
+         * This method parses complete requests into a batch, queueing every full batch.
+         * @param at_end as for RequestSize()
+         * @return number of bytes parsed, the rest is an incomplete request
+         */
+        size_t ParseRequests(const char* data, size_t size, size_t& batch, bool at_end);
+
+        /**
+         * This method queues a batch and takes an empty one to fill next.
+         * @param batch index of the batch to queue, replaced by the index of the empty one
+         */
+        void PushBatch(size_t& batch);
+        size_t PopBatch();
+
+        /**
+         * This method hands an answered batch back to be refilled.
+         * @param batch index of the batch
+         */
+        void ReleaseBatch(size_t batch);
+
+        /**
+         * This method classifies a batch and writes its predictions.
+         * @return false if the output can no longer be written
+         */
+        bool AnswerBatch(Batch& batch, int output_fd);
+
+        void RecordLatency(double microseconds);
+    };
+}
+
+#endif //NAIVE_BAYES_CLASSIFICATION_SERVER_H
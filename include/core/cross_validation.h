@@ -0,0 +1,114 @@
+#ifndef NAIVE_BAYES_CROSS_VALIDATION_H
+#define NAIVE_BAYES_CROSS_VALIDATION_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "core/model.h"
+#include "core/sample_index.h"
+#include "core/status.h"
+
+namespace naivebayes {
+    /**
+     * How the model of one fold did on the samples held out of it.
+     */
+    struct FoldResult {
+        // Samples the fold's model was trained on
+        size_t num_trained;
+        size_t passed_digit[10];
+        size_t total_digit[10];
+
+        /**
+         * This method returns the share of held out samples classified correctly.
+         * @return accuracy, 0 without samples
+         */
+        double GetAccuracy() const;
+
+        /**
+         * This method returns the share of held out samples of a digit classified correctly.
+         * @param digit
+         * @return accuracy, 0 without samples of the digit
+         */
+        double GetDigitAccuracy(int digit) const;
+    };
+
+    /**
+     * Stratified k-fold cross-validation. The samples of every digit are dealt
+     * to the folds in turn, so every fold has the same mix of digits as the file,
+     * and the counts of each fold are taken in one pass over the file. The model
+     * of a fold is then the total counts minus the fold's own, so evaluating a
+     * smoothing, or any number of them, takes k subtractions rather than k
+     * trainings.
+     */
+    class CrossValidator {
+    public:
+        /**
+         * Constructor
+         * @param num_shades number of shade levels the samples are quantized to
+         */
+        CrossValidator(int num_shades = 2);
+
+        /**
+         * This method deals the samples of a file to folds and counts every fold.
+         * The file is read through its SampleIndex sidecar when it has one.
+         * Malformed samples, and samples that do not have the dimension of the
+         * first, are left out.
+         * @param fileName
+         * @param num_folds at least 2, at most the number of samples
+         * @param num_threads number of worker threads
+         * @return kIoError, kInvalidArgument, or ok
+         */
+        Status Open(const std::string& fileName, size_t num_folds, size_t num_threads = 1);
+
+        size_t GetNumFolds() const;
+
+        /**
+         * This method returns the samples held out of a fold.
+         * @param fold below GetNumFolds()
+         * @return record numbers in the file's SampleIndex, in file order
+         */
+        const std::vector<size_t>& GetFoldRecords(size_t fold) const;
+
+        /**
+         * This method returns how many samples Open() left out.
+         * @return size_t
+         */
+        size_t GetSkippedRecords() const;
+
+        /**
+         * This method trains the model of every fold with a smoothing and
+         * classifies the samples held out of it. Folds are evaluated in parallel.
+         * @param laplace smoothing, see Model::SetLaplace()
+         * @param num_threads number of worker threads
+         * @return one result per fold, kInvalidModel before Open(), or kInvalidArgument
+         */
+        Result<std::vector<FoldResult>> Evaluate(double laplace, size_t num_threads = 1) const;
+
+    private:
+        int num_shades_;
+        SampleIndex index_;
+        // Records held out of every fold, in file order
+        std::vector<std::vector<size_t>> fold_records_;
+        // Counts of the records of every fold, and of all of them
+        std::vector<Model> fold_models_;
+        std::unique_ptr<Model> total_;
+        size_t num_skipped_;
+
+        /**
+         * This method counts a run of records into one model per fold.
+         * @param num_pixels dimension of the records that are counted
+         * @param fold_of fold of every record
+         * @param models one per fold
+         * @param num_skipped receives the number of records that were not counted
+         */
+        void CountRecords(size_t first, size_t last, int num_pixels, const std::vector<size_t>& fold_of,
+                          std::vector<Model>* models, size_t* num_skipped) const;
+
+        /**
+         * This method trains the model of one fold and classifies its records.
+         */
+        void EvaluateFold(size_t fold, double laplace, FoldResult* result) const;
+    };
+}
+
+#endif //NAIVE_BAYES_CROSS_VALIDATION_H
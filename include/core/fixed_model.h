@@ -0,0 +1,109 @@
+#ifndef NAIVE_BAYES_FIXED_MODEL_H
+#define NAIVE_BAYES_FIXED_MODEL_H
+
+#include <array>
+#include <memory>
+#include "core/sample.h"
+#include "core/scorer.h"
+
+namespace naivebayes {
+    /**
+     * Scoring tables whose dimensions are known at compile time, see FixedModel.
+     */
+    class FixedModelBase {
+    public:
+        virtual ~FixedModelBase() {}
+
+        /**
+         * This method scores a sample against every class.
+         * @param sample must have the dimension and shades the model was instantiated for
+         * @param scores receives the log posterior (up to a constant) of every class
+         * @return the class with the highest score
+         */
+        virtual int Score(const Sample& sample, double scores[Scorer::kClassStride]) const = 0;
+
+        /**
+         * This method returns the dimension of the samples the model was instantiated for.
+         * @return int
+         */
+        virtual int GetSampleLength() const = 0;
+
+        /**
+         * This method returns the number of shades the model was instantiated for.
+         * @return int
+         */
+        virtual int GetNumShades() const = 0;
+
+        /**
+         * This method copies the delta rows of one class after the Scorer updated it.
+         * @param digit class to copy
+         * @param deltas see Scorer::GetDeltas()
+         */
+        virtual void UpdateClass(int digit, const double* deltas) = 0;
+
+        /**
+         * This method copies the blank image scores of every class, which move
+         * together with the priors.
+         * @param blank_scores see Scorer::GetBlankScores()
+         */
+        virtual void SetBlankScores(const double* blank_scores) = 0;
+
+        /**
+         * This method copies the model, so that a copy shared with others can be updated.
+         * @return the copy
+         */
+        virtual std::shared_ptr<FixedModelBase> Clone() const = 0;
+    };
+
+    /**
+     * Copy of the Scorer tables for one image size, shade count and number of
+     * classes, fixed at compile time. Table sizes, the number of packed words of
+     * a sample and the row length are all constants, so the scoring loops have
+     * known trip counts the compiler can unroll and vectorize.
+     */
+    template <int Side, int Shades, int Classes>
+    class FixedModel : public FixedModelBase {
+    public:
+        static const size_t kPixels = (size_t) Side * Side;
+        static const size_t kRows = (Shades - 1) * kPixels;
+        static const size_t kWords = (kRows + Sample::kWordBits - 1) / Sample::kWordBits;
+
+        static_assert(Shades >= 2 && Classes >= 1 && Classes <= Scorer::kClassStride,
+                      "FixedModel dimensions do not fit the Scorer tables");
+
+        /**
+         * Constructor
+         * @param blank_scores Scorer::kClassStride doubles, see Scorer::GetBlankScores()
+         * @param deltas kRows * Scorer::kClassStride doubles, see Scorer::GetDeltas()
+         * @param row_mask kWords words, see Scorer::GetRowMask(); null to score every row
+         */
+        FixedModel(const double* blank_scores, const double* deltas, const uint64_t* row_mask = nullptr);
+
+        int Score(const Sample& sample, double scores[Scorer::kClassStride]) const override;
+        int GetSampleLength() const override;
+        int GetNumShades() const override;
+        void UpdateClass(int digit, const double* deltas) override;
+        void SetBlankScores(const double* blank_scores) override;
+        std::shared_ptr<FixedModelBase> Clone() const override;
+
+    private:
+        std::array<double, Scorer::kClassStride> log_blank_;
+        std::array<double, kRows * Scorer::kClassStride> log_delta_;
+        std::array<uint64_t, kWords> row_mask_;
+    };
+
+    /**
+     * This method copies scoring tables into the FixedModel instantiated for the
+     * given dimensions. Instantiations live in fixed_model.cpp.
+     * @param num_pixels dimension of the samples
+     * @param num_shades
+     * @param blank_scores see Scorer::GetBlankScores()
+     * @param deltas see Scorer::GetDeltas()
+     * @param row_mask see Scorer::GetRowMask(); null to score every row
+     * @return the model, or null if there is no instantiation for these dimensions
+     */
+    std::shared_ptr<FixedModelBase> MakeFixedModel(int num_pixels, int num_shades, const double* blank_scores,
+                                                         const double* deltas, const uint64_t* row_mask = nullptr);
+}
+
+#endif //NAIVE_BAYES_FIXED_MODEL_H
@@ -0,0 +1,114 @@
+#ifndef NAIVE_BAYES_LOGGER_H
+#define NAIVE_BAYES_LOGGER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Messages below this level are compiled out: 0 debug, 1 info, 2 warning, 3 error, 4 none
+#ifndef NAIVE_BAYES_MIN_LOG_LEVEL
+#define NAIVE_BAYES_MIN_LOG_LEVEL 0
+#endif
+
+/**
+ * Logs a message built with <<, e.g.
+ *   NAIVE_BAYES_LOG(kLogError, "Cannot open file for reading: " << filename);
+ * The message is only formatted when its level is compiled in and enabled.
+ */
+#define NAIVE_BAYES_LOG(level, message) \
+    do { \
+        if ((level) >= NAIVE_BAYES_MIN_LOG_LEVEL && ::naivebayes::Logger::IsEnabled(level)) { \
+            std::ostringstream log_message; \
+            log_message << message; \
+            ::naivebayes::Logger::Global().Write(log_message.str()); \
+        } \
+    } while (0)
+
+namespace naivebayes {
+    /**
+     * Levels of log messages, from the most to the least verbose.
+     *  kLogDebug:   details only useful when looking into a problem
+     *  kLogInfo:    progress and results, e.g. a file being trained on and the accuracy
+     *  kLogWarning: one sample or request that was skipped, the rest carries on
+     *  kLogError:   an operation that failed
+     */
+    enum LogLevel {
+        kLogDebug,
+        kLogInfo,
+        kLogWarning,
+        kLogError,
+        kLogOff
+    };
+
+    /**
+     * Process wide log. Messages are queued and written by a background thread,
+     * which flushes the output once per batch of messages rather than once per
+     * line, so logging never waits on the terminal or a pipe unless the queue
+     * is full. Messages are written in the order they were logged.
+     */
+    class Logger {
+    public:
+        // Messages queued before logging waits for the writer
+        static const size_t kMaxQueuedMessages = 4096;
+
+        static Logger& Global();
+
+        static bool IsEnabled(LogLevel level) {
+            return level >= level_.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * This method sets the least severe level that is logged, kLogInfo by default.
+         * @param level kLogOff to log nothing
+         */
+        static void SetLevel(LogLevel level);
+        static LogLevel GetLevel();
+
+        /**
+         * This method queues one line for the output.
+         * @param message without the line break
+         */
+        void Write(const std::string& message);
+
+        /**
+         * This method waits until every queued message is written and flushed.
+         */
+        void Flush();
+
+        /**
+         * This method writes every queued message to the old output, then sends
+         * later ones to another. The output is std::cout by default.
+         * @param output must stay valid while it is used
+         */
+        void SetOutput(std::ostream* output);
+
+    private:
+        static std::atomic<int> level_;
+
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::vector<std::string> queue_;
+        std::ostream* output_;
+        std::thread writer_;
+        bool stop_;
+        // Set while the writer holds messages taken off the queue
+        bool writing_;
+
+        Logger();
+        ~Logger();
+        Logger(const Logger&);
+        Logger& operator=(const Logger&);
+
+        /**
+         * This method runs on the writer thread until the logger is destroyed.
+         */
+        void WriteMessages();
+    };
+}
+
+#endif //NAIVE_BAYES_LOGGER_H
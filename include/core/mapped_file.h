@@ -0,0 +1,43 @@
+#ifndef NAIVE_BAYES_MAPPED_FILE_H
+#define NAIVE_BAYES_MAPPED_FILE_H
+
+#include <string>
+#include <vector>
+
+namespace naivebayes {
+    /**
+     * A read-only view of a whole file. On POSIX systems the file is memory
+     * mapped, elsewhere it is read into memory once.
+     */
+    class MappedFile {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        /**
+         * This method maps a file, replacing any file mapped before.
+         * @param fileName
+         * @return false if the file cannot be opened or mapped
+         */
+        bool Open(const std::string& fileName);
+
+        /**
+         * This method releases the mapping.
+         */
+        void Close();
+
+        const char* GetData() const;
+        size_t GetSize() const;
+
+    private:
+        const char* data_;
+        size_t size_;
+        // Holds the contents when the platform has no mmap
+        std::vector<char> buffer_;
+
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+    };
+}
+
+#endif //NAIVE_BAYES_MAPPED_FILE_H
@@ -0,0 +1,133 @@
+#ifndef NAIVE_BAYES_METRICS_H
+#define NAIVE_BAYES_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace naivebayes {
+    /**
+     * Phases of training and classification whose time is measured.
+     */
+    enum MetricPhase {
+        kOpenPhase,         // opening and mapping sample files
+        kParsePhase,        // decoding samples
+        kTrainPhase,        // counting samples into a model
+        kBuildTablesPhase,  // priors, likelihoods and scoring tables from the counts
+        kScorePhase,        // scoring samples
+        kLoadPhase,         // loading and mapping model files
+        kSavePhase,         // saving model files
+        kNumPhases
+    };
+
+    /**
+     * Events that are counted.
+     */
+    enum MetricCounter {
+        kSamplesParsed,
+        kBytesRead,         // size of the sample files opened
+        kSamplesTrained,
+        kSamplesClassified,
+        kInvalidSamples,    // malformed samples and samples that do not fit the model
+        kNumCounters
+    };
+
+    /**
+     * Process wide registry of phase times, counters and a histogram of the
+     * latency of Model::CalculateClassification(). It is disabled by default;
+     * then every instrumented place costs one check of a flag. Loops read the
+     * clock per sample only while it is enabled and add their totals once, so
+     * worker threads do not contend on it.
+     */
+    class Metrics {
+    public:
+        // Bucket i holds latencies below 2^(i + kFirstBucketBits) ns, the last one everything else
+        static const size_t kLatencyBuckets = 24;
+        static const size_t kFirstBucketBits = 6;
+
+        /**
+         * This method returns the registry every model reports to.
+         * @return Metrics&
+         */
+        static Metrics& Global();
+
+        static bool IsEnabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        static void SetEnabled(bool enabled);
+
+        /**
+         * This method returns a monotonic time stamp for timing phases.
+         * @return nanoseconds since an arbitrary point
+         */
+        static uint64_t Now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void AddTime(MetricPhase phase, uint64_t nanoseconds);
+        void AddCount(MetricCounter counter, uint64_t count = 1);
+        void RecordLatency(uint64_t nanoseconds);
+
+        uint64_t GetTime(MetricPhase phase) const;
+        uint64_t GetCount(MetricCounter counter) const;
+        uint64_t GetLatencyCount() const;
+
+        /**
+         * This method sets every time, counter and bucket back to 0.
+         */
+        void Reset();
+
+        /**
+         * This method writes the metrics as one JSON object.
+         * @param output
+         */
+        void WriteJson(std::ostream& output) const;
+
+        /**
+         * This method writes the metrics in the Prometheus text exposition format,
+         * times in seconds.
+         * @param output
+         */
+        void WritePrometheus(std::ostream& output) const;
+
+    private:
+        static std::atomic<bool> enabled_;
+
+        std::atomic<uint64_t> phase_nanoseconds_[kNumPhases];
+        std::atomic<uint64_t> counts_[kNumCounters];
+        std::atomic<uint64_t> latency_buckets_[kLatencyBuckets];
+        std::atomic<uint64_t> latency_count_;
+        std::atomic<uint64_t> latency_nanoseconds_;
+
+        Metrics();
+        Metrics(const Metrics&);
+        Metrics& operator=(const Metrics&);
+    };
+
+    /**
+     * Adds the time until it goes out of scope to a phase, when metrics were
+     * enabled as it was created.
+     */
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(MetricPhase phase) : phase_(phase), start_(Metrics::IsEnabled() ? Metrics::Now() : 0) {}
+
+        ~PhaseTimer() {
+            if (start_ != 0) {
+                Metrics::Global().AddTime(phase_, Metrics::Now() - start_);
+            }
+        }
+
+    private:
+        MetricPhase phase_;
+        uint64_t start_;
+
+        PhaseTimer(const PhaseTimer&);
+        PhaseTimer& operator=(const PhaseTimer&);
+    };
+}
+
+#endif //NAIVE_BAYES_METRICS_H
@@ -7,44 +7,111 @@
 
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <vector>
+#include "core/aligned_allocator.h"
+#include "core/fixed_model.h"
+#include "core/mapped_file.h"
+#include "core/metrics.h"
+#include "core/model_file.h"
 #include "core/sample.h"
+#include "core/sample_reader.h"
+#include "core/scorer.h"
+#include "core/status.h"
 
 using std::ifstream;
 using std::ofstream;
 
 namespace naivebayes {
+    /**
+     * What training from a file does with a sample that is malformed or does not
+     * fit the model.
+     *  kStopOnBadRecord: stop at it and leave the model invalid
+     *  kSkipBadRecords:  leave it out, count it and carry on with the next one
+     */
+    enum RecordPolicy {
+        kStopOnBadRecord,
+        kSkipBadRecords
+    };
+
     class Model {
     public:
         /**
          * Constructor
+         * @param num_shades number of shade levels the training samples are quantized
+         *                   to, see Sample. Loading a model file replaces it.
+         */
+        Model(int num_shades = 2);
+
+        /**
+         * This method trains the model on a file. With more than one thread the
+         * file is split at sample boundaries, taken from its SampleIndex sidecar
+         * when it has one, and every thread counts its own shard;
+         * the counts are merged before the probabilities are computed, so the
+         * result is identical to the single threaded build. An untrained model
+         * takes its dimension from the first well formed sample.
+         * @param fileName
+         * @param num_threads number of worker threads
+         * @param policy what to do with bad samples, see GetSkippedRecords()
+         * @return the error that stopped training; the model is then invalid
+         */
+        Status TrainFile(const string& fileName, size_t num_threads = 1, RecordPolicy policy = kSkipBadRecords);
+
+        /**
+         * This method returns how many samples the last TrainFile() left out.
+         * @return size_t
          */
-        Model();
+        size_t GetSkippedRecords() const;
 
         /**
-         * This method builds the model from a file.
+         * This method builds the model from a file like TrainFile(), stopping at
+         * the first bad sample, and logs the error.
          * @param fileName
+         * @param num_threads number of worker threads
          */
-        void BuildModel(std::string fileName);
+        void BuildModel(std::string fileName, size_t num_threads = 1);
 
         /**
-         * This method prints the model.
+         * This method prints the model to cout, after the messages logged before it.
          */
         void Print();
 
         /**
          * This method saves a trained model to a file.
          * @param filename
-         * @return int for error checking
+         * @param format text, or the binary format described in model_file.h
+         * @return kInvalidModel, kIoError, or ok
+         */
+        Status SaveFile(const string& filename, ModelFormat format = kTextModel);
+
+        /**
+         * This method loads a file back into a model. The format is detected from
+         * the contents of the file.
+         * @param filename
+         * @return kIoError, kFormatError for an unsupported or corrupt file, or ok;
+         *         the model is invalid after an error
+         */
+        Status LoadFile(const string& filename);
+
+        /**
+         * This method memory maps a binary model file read-only. Likelihoods and
+         * scoring tables are read in place, so processes mapping the same file
+         * share one copy in the page cache and mapping takes the same time for
+         * any model size. A mapped model has no training counts. Files saved after
+         * SelectPixels() hold compact tables, so they are loaded instead.
+         * @param filename
+         * @return kIoError, kFormatError, or ok; the model is invalid after an error
          */
-        int Save(string filename);
+        Status MapFile(const string& filename);
 
         /**
-         * This method loads a file back into a model.
+         * These methods are SaveFile(), LoadFile() and MapFile() logging the error.
          * @param filename
-         * @return int for error checking
+         * @return 1 on success, 0 on error
          */
+        int Save(string filename, ModelFormat format = kTextModel);
         int Load(string filename);
+        int Map(string filename);
 
         /**
          * This method calculates the total number of samples in a model.
@@ -74,30 +141,291 @@ namespace naivebayes {
          * @return int
          */
         int GetSampleLength();
-        void ProcessSample(Sample& sample);
 
-        double Classify(string filename, double digit_accuracy[10]);
+        /**
+         * This method returns the number of shade levels a pixel can take in the model.
+         * @return int
+         */
+        int GetNumShades();
+
+        /**
+         * This method counts a well formed sample into the model, setting up the
+         * dimension of an untrained model. The model must have training counts,
+         * see Train(). It leaves the model as it was on error.
+         * @param sample
+         * @return kInvalidModel if the model has no training counts (mapped, or
+         *         loaded from a file without them), kFormatError for a malformed
+         *         sample, kDimensionMismatch, or ok
+         */
+        Status ProcessSample(const Sample& sample);
+
+        /**
+         * This method adds one labelled sample to the training counts. Priors and
+         * likelihoods are not recomputed here; the classes that changed are marked
+         * and brought up to date by the next call that reads the model.
+         * @param sample
+         * @return kInvalidModel if the model has no training counts (mapped, or
+         *         loaded from a file without them), kFormatError, kDimensionMismatch, or ok
+         */
+        Status Train(const Sample& sample);
+
+        /**
+         * This method adds a batch of labelled samples to the training counts,
+         * logging a warning for every sample that does not fit the model.
+         * @param samples
+         * @return number of samples that were added, or kInvalidModel if the model
+         *         has no training counts
+         */
+        Result<size_t> Train(const vector<Sample>& samples);
+
+        /**
+         * This method adds the training counts of another model into this one, as
+         * if this model had also been trained on the other model's samples. Models
+         * saved in the binary format keep their counts and can be merged after Load.
+         * @param other model trained on samples of the same dimension and smoothing
+         * @return kInvalidModel if either model has no counts, kDimensionMismatch,
+         *         kInvalidArgument if the smoothing differs, or ok
+         */
+        Status Merge(const Model& other);
+
+        /**
+         * This method removes the training counts of another model from this one,
+         * undoing a Merge of the same model. The model is left unchanged on error.
+         * @param other model whose samples were counted into this one
+         * @return kInvalidModel if either model has no counts, kDimensionMismatch,
+         *         kInvalidArgument if the smoothing differs or the counts of other
+         *         are not part of this model, or ok
+         */
+        Status Subtract(const Model& other);
+
+        /**
+         * This method classifies every sample in a file and reports the accuracy.
+         * The samples are split evenly across num_threads worker threads.
+         * @param filename
+         * @param digit_accuracy receives the accuracy of each digit
+         * @param num_threads number of worker threads, at least 1
+         * @return overall accuracy, or -1 if the file cannot be read
+         */
+        double Classify(string filename, double digit_accuracy[10], size_t num_threads = 1);
+
+        /**
+         * This method classifies a sample by summing log probabilities, so the
+         * result does not underflow on large images.
+         * @param sample
+         * @return the most likely digit, kInvalidModel, or kDimensionMismatch
+         */
+        Result<int> Predict(const Sample& sample);
+
+        /**
+         * This method is Predict() logging the error.
+         * @param sample
+         * @return the most likely digit, or -1 if the sample does not fit the model
+         */
         int CalculateClassification(Sample& sample);
 
+        /**
+         * This method classifies a sample and also returns how sure the model is.
+         * The class scores of the single scoring pass are normalized with
+         * log-sum-exp into log posteriors, so they do not underflow either.
+         * @param sample
+         * @param log_posteriors receives log P(digit | sample) of every digit; their
+         *                       exponentials sum to 1
+         * @param top receives the k most likely digits, most likely first, ties
+         *            going to the lower digit like CalculateClassification
+         * @param k number of digits to write to top, at most 10
+         * @return the most likely digit, kInvalidModel, kDimensionMismatch, or
+         *         kInvalidArgument if k is not 0 and there is no top to write to
+         */
+        Result<int> CalculatePosteriors(const Sample& sample, double log_posteriors[10], int top[] = nullptr,
+                                        size_t k = 0);
+
+        /**
+         * This method shrinks the model to the pixels that tell the digits apart
+         * best. Pixels are ranked by the mutual information between their shade
+         * and the label, computed from the training counts, and the top num_kept
+         * are kept. The other pixels get the same likelihood for every shade, so
+         * they no longer affect any score, and are skipped when scoring and left
+         * out of saved models. The counts of every pixel are kept, so training or
+         * merging later still works and SelectPixels can be called again.
+         * @param num_kept number of pixels to keep; all of them if it is at least
+         *                 the number of pixels in a sample
+         * @return kInvalidModel if the model has no training counts, kInvalidArgument
+         *         if num_kept is 0, or ok
+         */
+        Status SelectPixels(size_t num_kept);
+
+        /**
+         * This method sets the Laplace smoothing of the probabilities: the count
+         * added to every shade of every pixel, and to every class, before they are
+         * normalized. Probabilities are recomputed from the training counts by
+         * the next call that reads the model. It is 1 by default, and saved
+         * with the model.
+         * @param laplace greater than 0
+         * @return kInvalidArgument if laplace is not positive, kInvalidModel if the
+         *         model has no training counts, or ok
+         */
+        Status SetLaplace(double laplace);
+        double GetLaplace() const;
+
+        /**
+         * This method returns the pixels kept by SelectPixels().
+         * @return indices in row major order, increasing; empty when every pixel is used
+         */
+        const vector<uint32_t>& GetSelectedPixels() const;
+
     private:
         int train_class_total_[10];
         int train_total_;
-        // 10 x 2 x num_pixels_^2
-        vector<vector<vector<int>>> pixel_class_count_;
+        // [digit][shade][pixel], 10 x num_shades_ x num_pixels_^2, see TableIndex()
+        AlignedVector<int> pixel_class_count_;
         int num_pixels_;
-        // values for pixels can be 0..1
-        const int kNumShades = 2;
-        const double kLaplace = 1.0;
+        // values for pixels can be 0..num_shades_ - 1
+        int num_shades_;
+        // Count added to every shade of every pixel and to every class, see SetLaplace()
+        double laplace_;
         const int kDigits = 10;
         // Probabilities
         double p_prior_[10];
-        vector<double> p_likelihood_class_pixel_[10][2];
+        // Same layout as pixel_class_count_ and the likelihoods of the binary model file
+        AlignedVector<double> p_likelihood_;
+        // Log tables derived from the probabilities above, used for classification
+        Scorer scorer_;
+        // Copy of the scorer tables for dimensions with a compiled FixedModel, else null.
+        // Copies of the model share it until one of them changes its tables.
+        std::shared_ptr<FixedModelBase> fixed_model_;
+        // Set by SelectPixels(), increasing pixel indices; empty when every pixel is used
+        vector<uint32_t> selected_pixels_;
+        // Set by Map(): the file and the likelihood table inside it
+        std::shared_ptr<MappedFile> mapped_file_;
+        const double* mapped_likelihood_;
 
 
 
+        // Set by BuildShard(): the error that stopped the shard
+        Status shard_status_;
+        // Bad samples left out by the last TrainFile()
+        size_t skipped_records_;
+        // Classes whose counts changed since their likelihoods were computed, see Train()
+        bool class_dirty_[10];
+        bool model_dirty_;
+
         void BuildPrior();
         void BuildLikelihood();
 
+        /**
+         * This method recomputes the likelihoods of one class from its counts.
+         * Pixels left out by SelectPixels() get the same likelihood for every shade.
+         */
+        void BuildClassLikelihood(int digit);
+
+        /**
+         * This method computes the mutual information between the shade of a pixel
+         * and the label from the training counts.
+         * @param pixel index in row major order
+         * @return information in nats
+         */
+        double PixelInformation(size_t pixel) const;
+
+        /**
+         * This method brings priors, likelihoods and scoring tables up to date with
+         * the counts, touching only classes that were trained on since the last call.
+         */
+        void Refresh();
+
+        /**
+         * This method drops the training counts, for models that come from a file.
+         */
+        void ClearCounts();
+
+        Status SaveBinary(const string& filename);
+        Status LoadBinary(ifstream& my_file, const string& filename);
+        Status ReadBinaryHeader(const char* data, size_t size, const string& filename, bool verify_checksum,
+                                ModelFileHeader& header, ModelFileLayout& layout) const;
+        void Unmap();
+
+        /**
+         * This method fills the likelihoods and scoring tables from the compact
+         * tables of a binary model file saved after SelectPixels().
+         * @return false if the pixel indices are out of range or not increasing
+         */
+        bool ExpandSelection(const char* indices, size_t num_selected, const double* likelihood,
+                             const double* blank_scores, const double* deltas);
+
+        // Likelihoods of one class and shade for every pixel, wherever they are stored
+        const double* LikelihoodRow(int digit, int value) const;
+
+        // Position of a digit, shade and pixel in the count and likelihood tables
+        size_t TableIndex(int digit, int value, size_t pixel) const;
+
+        /**
+         * This method maps a sample file, reporting its size to the metrics.
+         * @return kIoError if the file cannot be opened
+         */
+        Status OpenSamples(const string& fileName, SampleReader& reader) const;
+
+        /**
+         * This method splits a sample file among threads, at the records of its
+         * index sidecar when it has a usable one and by scanning it otherwise.
+         * @return between 1 and num_parts readers
+         */
+        vector<SampleReader> SplitSamples(const string& fileName, const SampleReader& reader, size_t num_parts) const;
+
+        /**
+         * This method sets up empty counts for samples of a dimension.
+         */
+        void StartCounts(int num_pixels);
+
+        /**
+         * This method counts every remaining sample of a reader into the model,
+         * adding the bad samples it skips to skipped_records_.
+         * @return the bad sample that stopped counting under kStopOnBadRecord
+         */
+        Status ProcessSamples(SampleReader& reader, RecordPolicy policy);
+
+        /**
+         * This method counts one shard of a training file, setting shard_status_.
+         */
+        void BuildShard(SampleReader reader, RecordPolicy policy);
+
+        /**
+         * This method adds the counts of another model into this one.
+         * @return kDimensionMismatch if the image dimensions differ, or ok
+         */
+        Status AddCounts(const Model& other);
+
+        // True unless the model came from a file without training counts
+        bool HasCounts() const;
+
+        /**
+         * This method classifies every sample of a reader and counts the results per digit.
+         * It only reads the model, so several readers can be classified concurrently.
+         */
+        void ClassifyRange(SampleReader reader, size_t passed_digit[10], size_t total_digit[10]) const;
+
+        /**
+         * This method scores a sample with the FixedModel when there is one for its
+         * dimensions, and with the runtime scorer otherwise.
+         * @return the best class, or -1 if the sample does not fit the model
+         */
+        int ScoreSample(const Sample& sample, double scores[Scorer::kClassStride]) const;
+
+        /**
+         * This method recreates fixed_model_ from the scorer tables after they changed.
+         */
+        void SyncScoringTables();
+
+        /**
+         * This method brings fixed_model_ up to date after Refresh() updated some
+         * classes of the scorer, copying it first if other models share it.
+         * @param classes the classes that were updated
+         */
+        void UpdateFixedModel(const bool classes[10]);
+
+        /**
+         * This method finds the most likely digit of a sample that fits the model.
+         * @return digit, or -1 if the sample does not fit the model
+         */
+        int ClassifySample(const Sample& sample) const;
     };
 }
 
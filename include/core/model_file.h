@@ -0,0 +1,104 @@
+#ifndef NAIVE_BAYES_MODEL_FILE_H
+#define NAIVE_BAYES_MODEL_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace naivebayes {
+    /**
+     * File formats understood by Model::Save. Model::Load tells them apart by
+     * the magic bytes at the start of the binary format.
+     */
+    enum ModelFormat {
+        kTextModel,
+        kBinaryModel
+    };
+
+    /**
+     * Header of the binary model format. It is followed by the payload, a set of
+     * double arrays in native byte order, each starting on a kModelFileAlignment
+     * boundary of the file:
+     *   priors       [num_classes]
+     *   likelihoods  [num_classes][num_shades][num_pixels * num_pixels]
+     *   blank scores [class_stride]
+     *   deltas       [num_shades - 1][num_pixels * num_pixels][class_stride]
+     * The last two are the Scorer tables, so a loaded model needs no log() calls.
+     * With kModelFileHasCounts set in flags the training counts follow as int32:
+     *   class totals [num_classes]
+     *   pixel counts [num_classes][num_shades][num_pixels * num_pixels]
+     * so that models trained apart can be loaded and merged exactly.
+     * With kModelFileHasSelection set, only the num_selected pixels chosen by
+     * Model::SelectPixels() are stored: the likelihoods and deltas above hold
+     * num_selected pixels instead of num_pixels * num_pixels, and the indices of
+     * those pixels follow the deltas as uint32:
+     *   selected pixels [num_selected]
+     * The training counts, if any, still cover every pixel.
+     * The header also keeps the Laplace smoothing the probabilities were
+     * computed with, which training the loaded counts further goes on using.
+     */
+    struct ModelFileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_pixels;
+        uint32_t num_shades;
+        uint32_t num_classes;
+        uint32_t class_stride;
+        uint32_t flags;
+        uint64_t payload_size;
+        // FNV-1a over the payload
+        uint64_t checksum;
+        // Pixels stored with kModelFileHasSelection, else 0
+        uint32_t num_selected;
+        char reserved[4];
+        // Laplace smoothing, see Model::SetLaplace(); 0 in files saved before it was kept, which used 1
+        double laplace;
+    };
+
+    const char kModelFileMagic[8] = {'N', 'B', 'M', 'O', 'D', 'E', 'L', '\0'};
+    const uint32_t kModelFileVersion = 1;
+    const size_t kModelFileAlignment = 64;
+    // Header flag: the file ends with the training counts
+    const uint32_t kModelFileHasCounts = 1;
+    // Header flag: only a selection of the pixels is stored
+    const uint32_t kModelFileHasSelection = 2;
+
+    /**
+     * Byte offsets of the payload arrays, relative to the start of the file.
+     */
+    struct ModelFileLayout {
+        size_t prior;
+        size_t likelihood;
+        size_t blank_scores;
+        size_t deltas;
+        // Only meaningful for files with a selection
+        size_t selected_pixels;
+        // Only meaningful for files with counts
+        size_t class_totals;
+        size_t pixel_counts;
+        // Total file size
+        size_t size;
+    };
+
+    /**
+     * This method computes where each array of a binary model file lives.
+     * @param num_pixels dimension of the samples
+     * @param num_shades
+     * @param num_classes
+     * @param class_stride
+     * @param with_counts whether the file carries the training counts
+     * @param num_selected number of selected pixels stored, 0 when all are
+     * @return layout
+     */
+    ModelFileLayout GetModelFileLayout(size_t num_pixels, size_t num_shades, size_t num_classes, size_t class_stride,
+                                       bool with_counts = false, size_t num_selected = 0);
+
+    /**
+     * This method computes the FNV-1a hash of a block of bytes.
+     * @param data
+     * @param size
+     * @return 64 bit hash
+     */
+    uint64_t ModelFileChecksum(const char* data, size_t size);
+}
+
+#endif //NAIVE_BAYES_MODEL_FILE_H
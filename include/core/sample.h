@@ -5,10 +5,15 @@
 #ifndef NAIVE_BAYES_SAMPLE_H
 #define NAIVE_BAYES_SAMPLE_H
 
+#include <cstdint>
 #include <iostream>
 #include <vector>
 #include <fstream>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 using std::ifstream;
 using std::vector;
 using std::string;
@@ -19,18 +24,59 @@ using std::endl;
 namespace naivebayes {
     class Sample {
     public:
-        Sample(int numPixel = -1);
-        Sample(string fileName);
+        /**
+         * Constructor
+         * @param numPixel dimension of the image, or -1 to take it from the input
+         * @param numShades number of shade levels a pixel is quantized to, 2 to kMaxShades
+         */
+        Sample(int numPixel = -1, int numShades = 2);
+        Sample(string fileName, int numShades = 2);
 
         friend istream& operator>>(istream& input, Sample& sample);
+        friend class SampleReader;
 
-        int GetDigit();
-        int GetSampleLength();
+        int GetDigit() const;
+        int GetSampleLength() const;
+        int GetNumShades() const;
         int SetPixel(size_t row, size_t col, size_t shade);
         int GetPixel(size_t row, size_t col) const;
-        vector<int> &GetImagePixels();
+
+        /**
+         * This method returns the packed pixels of the image, one bit plane per shade
+         * above 0 laid end to end. Pixel i in row major order has shade v > 0 when
+         * bit b = (v - 1) * num_pixels^2 + i is set, i.e. bit b % 64 of word b / 64;
+         * a pixel of shade 0 has no bit set. With two shades this is a plain bitmap
+         * of the shaded pixels. Bits past the last plane are always clear.
+         * @return packed pixel words
+         */
+        const vector<uint64_t> &GetPackedPixels() const;
+
+        /**
+         * This method replaces the image with packed pixels in the layout of
+         * GetPackedPixels(), e.g. a record of the packed binary sample format.
+         * The sample must already have its dimension and shades.
+         * @param words
+         * @param num_words must match GetPackedPixels().size()
+         * @return 0, or -1 if the number of words does not fit
+         */
+        int SetPackedPixels(const uint64_t* words, size_t num_words);
+        void SetDigit(int digit);
         void Clear();
 
+        /**
+         * This method gives the sample new dimensions, a cleared image and no digit,
+         * so that one sample can be refilled for every record of a read loop. The
+         * pixel storage is kept, nothing is allocated unless the image grows.
+         * @param numPixel dimension of the image
+         * @param numShades number of shade levels, 2 to kMaxShades
+         * @return 0, or -1 if the dimensions are not valid
+         */
+        int Reset(int numPixel, int numShades);
+
+        static const size_t kWordBits = 64;
+        // Enough levels for a full 8 bit grayscale image
+        static const int kMaxShades = 256;
+
         // For error checking of return values of GetSampleLength()
         const int kSampleIgnore = -2;
         const int kSampleError = -1;
@@ -38,8 +84,34 @@ namespace naivebayes {
     private:
         size_t digit_;
         size_t num_pixels_;
-        vector<int> image_pixels_;
+        size_t num_shades_;
+        // One bit per pixel and shade above 0, see GetPackedPixels()
+        vector<uint64_t> image_pixels_;
+
+        void Resize(size_t numPixel);
+
+        // Sets the bits of every shaded character in one image row of num_pixels_ characters
+        void DecodeRow(size_t row, const char* line);
+
+        // Shade of an input character: ' ' is 0, '#' (or anything else) is the darkest
+        // shade and '+' sits half way between them
+        size_t Quantize(char pixel) const;
     };
+
+    /**
+     * This method returns the index of the lowest set bit of a packed pixel word.
+     * @param word must not be 0
+     * @return bit index
+     */
+    inline size_t CountTrailingZeros(uint64_t word) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return index;
+#else
+        return __builtin_ctzll(word);
+#endif
+    }
 }
 
 #endif //NAIVE_BAYES_SAMPLE_H
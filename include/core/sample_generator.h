@@ -0,0 +1,84 @@
+#ifndef NAIVE_BAYES_SAMPLE_GENERATOR_H
+#define NAIVE_BAYES_SAMPLE_GENERATOR_H
+
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <vector>
+#include "core/model.h"
+#include "core/sample.h"
+
+namespace naivebayes {
+    /**
+     * Formats WriteSample() can write.
+     *  kAsciiSamples:  the training file format, a label line followed by one line
+     *                  per image row; shade 0 is ' ', the darkest shade '#' and any
+     *                  shade in between '+', so models with more than 3 shades
+     *                  read back coarser.
+     *  kPackedSamples: one byte label followed by the sample's packed pixel words in
+     *                  native byte order, the records ClassificationServer reads as
+     *                  kPackedRequests.
+     */
+    enum SampleFormat {
+        kAsciiSamples,
+        kPackedSamples
+    };
+
+    /**
+     * This method writes one labelled sample.
+     * @param sample
+     * @param format
+     * @param output
+     * @return false if the output could not be written
+     */
+    bool WriteSample(const Sample& sample, SampleFormat format, std::ostream& output);
+
+    /**
+     * Draws samples from the distribution a trained model describes: the digit
+     * from the priors, then the shade of every pixel on its own from that digit's
+     * likelihoods. The same model and seed give the same samples on every
+     * platform. Samples are produced one at a time, so any number of them can be
+     * written without holding them in memory.
+     */
+    class SampleGenerator {
+    public:
+        /**
+         * Constructor
+         * @param model trained, loaded or mapped model; its probabilities are copied
+         * @param seed
+         */
+        SampleGenerator(Model& model, uint64_t seed);
+
+        /**
+         * This method draws the next sample.
+         * @param sample receives the sample, its storage is reused when the dimensions match
+         * @return false if the model was not valid
+         */
+        bool Next(Sample& sample);
+
+        /**
+         * This method returns the dimension of the samples, or -1 without a valid model.
+         * @return int
+         */
+        int GetSampleLength() const;
+
+        int GetNumShades() const;
+
+    private:
+        int num_pixels_;
+        int num_shades_;
+        std::mt19937_64 random_;
+        // Running sum of the priors, the digit is the first entry above a uniform draw
+        double prior_cdf_[10];
+        // [digit][pixel][shade - 1], P(shade of the pixel >= shade) for shades above 0
+        vector<double> shade_cdf_;
+        // Packed pixels of the sample being drawn
+        vector<uint64_t> words_;
+
+        // Uniform in [0, 1) from the top 53 bits of the generator, the same everywhere
+        // unlike std::uniform_real_distribution
+        double Uniform();
+    };
+}
+
+#endif //NAIVE_BAYES_SAMPLE_GENERATOR_H
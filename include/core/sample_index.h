@@ -0,0 +1,183 @@
+#ifndef NAIVE_BAYES_SAMPLE_INDEX_H
+#define NAIVE_BAYES_SAMPLE_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "core/sample.h"
+#include "core/sample_reader.h"
+#include "core/status.h"
+
+namespace naivebayes {
+    /**
+     * Header of the index sidecar file. It is followed by
+     *   offsets [num_records] uint64, byte offset of every record in the sample file
+     *   labels  [num_records] uint8, digit of every record
+     * in native byte order. data_size, data_mtime and data_hash describe the
+     * sample file that was indexed, so an index left over from another version
+     * of it is refused, even one of the same size.
+     */
+    struct SampleIndexHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t num_records;
+        // Malformed records the index leaves out
+        uint64_t num_skipped;
+        uint64_t data_size;
+        // Modification time of the sample file, seconds since the epoch
+        int64_t data_mtime;
+        // Hash of blocks spread evenly over the sample file, see GetSampleIndexHash()
+        uint64_t data_hash;
+        // FNV-1a over the offsets and labels
+        uint64_t checksum;
+    };
+
+    const char kSampleIndexMagic[8] = {'N', 'B', 'I', 'N', 'D', 'E', 'X', '\0'};
+    const uint32_t kSampleIndexVersion = 2;
+
+    /**
+     * This method hashes the contents of a sample file for its index: the whole
+     * file when it is small, else blocks spread evenly over it, the first and
+     * last included, so checking an index costs far less than indexing again.
+     * @param data
+     * @param size
+     * @return 64 bit hash
+     */
+    uint64_t GetSampleIndexHash(const char* data, size_t size);
+
+    /**
+     * Byte offset and label of every well formed record of an ASCII sample file.
+     * With it any record, or every record of one digit, is read without scanning
+     * the file, and the file splits into shards of exactly equal numbers of
+     * records whatever their dimensions. The index is built by one pass over the
+     * file and kept in a sidecar next to it, see GetSidecarName().
+     */
+    class SampleIndex {
+    public:
+        SampleIndex();
+
+        /**
+         * This method returns the name of the sidecar an index of a sample file is kept in.
+         * @param sampleFile
+         * @return the name of the sample file followed by ".idx"
+         */
+        static std::string GetSidecarName(const std::string& sampleFile);
+
+        /**
+         * This method maps a sample file and indexes it, reading every record once.
+         * @param sampleFile
+         * @param num_shades number of shade levels samples are read with
+         * @return kIoError if the file cannot be opened
+         */
+        Status Build(const std::string& sampleFile, int num_shades = 2);
+
+        /**
+         * This method writes the index to a sidecar file.
+         * @param indexFile
+         * @return kIoError if the file cannot be written
+         */
+        Status Save(const std::string& indexFile) const;
+
+        /**
+         * This method maps a sample file and reads its index from a sidecar file.
+         * @param sampleFile
+         * @param indexFile
+         * @param num_shades number of shade levels samples are read with
+         * @return kIoError, or kFormatError if the index is corrupt or was built
+         *         from another version of the file: one of another size, another
+         *         modification time, or other contents in the hashed blocks
+         */
+        Status Load(const std::string& sampleFile, const std::string& indexFile, int num_shades = 2);
+
+        /**
+         * This method loads the sidecar of a sample file, or builds the index and
+         * writes the sidecar when there is no usable one.
+         * @param sampleFile
+         * @param num_shades number of shade levels samples are read with
+         * @return kIoError if the sample file cannot be opened; failing to write
+         *         the sidecar is only logged
+         */
+        Status Open(const std::string& sampleFile, int num_shades = 2);
+
+        size_t GetNumRecords() const;
+
+        /**
+         * This method returns how many malformed records the index leaves out.
+         * @return size_t
+         */
+        size_t GetSkippedRecords() const;
+
+        size_t GetOffset(size_t record) const;
+        int GetDigit(size_t record) const;
+
+        /**
+         * This method returns every record of a digit.
+         * @param digit 0 to 9
+         * @return record numbers in file order
+         */
+        const std::vector<size_t>& GetRecordsOfDigit(int digit) const;
+
+        /**
+         * This method reads one record. It moves the index's own reader, so
+         * threads read through readers of their own, see GetReader().
+         * @param record number of the record, below GetNumRecords()
+         * @param sample receives the sample, its storage is reused
+         * @return kEndOfInput for a record past the end, kFormatError if the file
+         *         no longer holds the indexed digit there, else as SampleReader::Read()
+         */
+        Status ReadAt(size_t record, Sample& sample);
+
+        /**
+         * This method returns a reader over a run of records. Malformed records
+         * between them, which the index leaves out, are read as well.
+         * @param first first record
+         * @param last one past the last record
+         * @return SampleReader sharing the index's mapping of the file
+         */
+        SampleReader GetReader(size_t first, size_t last) const;
+
+        /**
+         * This method splits the records into runs of equal length, give or take one.
+         * @param num_parts
+         * @return between 1 and num_parts readers
+         */
+        std::vector<SampleReader> Split(size_t num_parts) const;
+
+    private:
+        SampleReader reader_;
+        std::vector<uint64_t> offsets_;
+        std::vector<uint8_t> labels_;
+        std::vector<size_t> digit_records_[10];
+        size_t num_skipped_;
+        // Modification time of the file reader_ has open, taken before it was opened
+        int64_t data_mtime_;
+
+        /**
+         * This method opens a sample file and notes its modification time.
+         * @return kIoError if the file cannot be opened
+         */
+        Status OpenFile(const std::string& sampleFile, int num_shades);
+
+        // Drops every record
+        void Clear();
+
+        /**
+         * This method indexes the file reader_ has open.
+         */
+        void Scan(const std::string& sampleFile);
+
+        /**
+         * This method reads the index of the file reader_ has open from a sidecar.
+         * @return as Load()
+         */
+        Status ReadSidecar(const std::string& sampleFile, const std::string& indexFile);
+
+        /**
+         * This method fills digit_records_ from the labels.
+         */
+        void GroupByDigit();
+    };
+}
+
+#endif //NAIVE_BAYES_SAMPLE_INDEX_H
@@ -0,0 +1,133 @@
+#ifndef NAIVE_BAYES_SAMPLE_READER_H
+#define NAIVE_BAYES_SAMPLE_READER_H
+
+#include <memory>
+#include "core/mapped_file.h"
+#include "core/sample.h"
+#include "core/status.h"
+
+namespace naivebayes {
+    /**
+     * Reads samples in the ASCII image format straight out of a memory mapped
+     * file. Rows are decoded from the mapped bytes into the packed pixels of a
+     * caller provided sample, without copying lines into strings.
+     */
+    class SampleReader {
+    public:
+        SampleReader();
+
+        /**
+         * This method maps a file and positions the reader at its first sample.
+         * @param fileName
+         * @param num_shades number of shade levels the samples are quantized to
+         * @return false if the file cannot be opened
+         */
+        bool Open(const string& fileName, int num_shades = 2);
+
+        /**
+         * This method positions the reader at the start of samples held in memory
+         * the caller owns, e.g. records received over a connection. The memory
+         * must stay valid while the reader is used.
+         * @param begin first byte of the first sample
+         * @param end one past the last byte
+         * @param num_shades number of shade levels the samples are quantized to
+         */
+        void Attach(const char* begin, const char* end, int num_shades = 2);
+
+        /**
+         * This method reads the next sample. Blank lines between samples are passed
+         * over. A malformed sample is consumed up to the next line holding just a
+         * digit, where the following sample starts, so reading can carry on after it.
+         * Nothing is logged; the caller decides whether a bad sample matters.
+         * @param sample receives the sample, its storage is reused. A malformed one
+         *               has GetSampleLength() == kSampleError.
+         * @return kOk, kEndOfInput once there are no more samples, or kFormatError
+         *         with the byte offset of the malformed sample
+         */
+        Status Read(Sample& sample);
+
+        /**
+         * This method reads the next sample like Read(), logging a warning for a
+         * malformed one.
+         * @param sample receives the sample, its storage is reused
+         * @return false once there are no more samples
+         */
+        bool Next(Sample& sample);
+
+        /**
+         * This method moves the reader to a sample and reads it like Read().
+         * @param offset start of the sample, relative to the start of the file or
+         *               of the attached memory, e.g. taken from a SampleIndex
+         * @param sample receives the sample, its storage is reused
+         * @return kEndOfInput if the offset is outside the reader
+         */
+        Status ReadAt(size_t offset, Sample& sample);
+
+        /**
+         * This method returns a reader over part of this reader's input.
+         * @param begin offset of the first sample, relative to the start of the
+         *              file or of the attached memory
+         * @param end offset one past the last byte; both are kept within this reader
+         * @return SampleReader sharing this reader's file
+         */
+        SampleReader Slice(size_t begin, size_t end) const;
+
+        /**
+         * This method returns where the sample returned last starts.
+         * @return offset relative to the start of the file, or of the attached memory
+         */
+        size_t GetRecordOffset() const;
+
+        /**
+         * This method finds the byte offset of every sample in the remaining input,
+         * malformed ones included, from the label lines that start them.
+         * @return offsets relative to the start of the file, or of the attached memory
+         */
+        vector<size_t> FindRecordOffsets() const;
+
+        /**
+         * This method splits the remaining input at sample boundaries into
+         * readers over roughly equal numbers of samples.
+         * @param num_parts
+         * @return between 1 and num_parts readers sharing this reader's file
+         */
+        vector<SampleReader> Split(size_t num_parts) const;
+
+        /**
+         * This method returns the number of bytes this reader covers.
+         * @return size_t
+         */
+        size_t GetSize() const;
+
+        /**
+         * This method returns the first byte this reader covers, GetSize() bytes follow.
+         * @return pointer into the mapped file, or into the attached memory
+         */
+        const char* GetData() const;
+
+    private:
+        std::shared_ptr<MappedFile> file_;
+        const char* begin_;
+        const char* position_;
+        const char* end_;
+        // Start of the sample returned last
+        const char* record_;
+        int num_shades_;
+
+        SampleReader(const std::shared_ptr<MappedFile>& file, const char* begin, const char* end, int num_shades);
+
+        // Start of the file, or of the attached memory, that offsets are relative to
+        const char* Base() const;
+
+        // Returns the end of the line starting at position_ (a '\n' or end_)
+        const char* LineEnd() const;
+
+        /**
+         * This method marks the sample as malformed and moves past it.
+         * @return kFormatError describing the problem
+         */
+        Status Malformed(Sample& sample, const char* problem);
+    };
+}
+
+#endif //NAIVE_BAYES_SAMPLE_READER_H
@@ -0,0 +1,72 @@
+#ifndef NAIVE_BAYES_SCORE_KERNEL_H
+#define NAIVE_BAYES_SCORE_KERNEL_H
+
+#include <cstdint>
+#include "core/sample.h"
+#include "core/scorer.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace naivebayes {
+    /**
+     * This method adds the table row of every set bit in the packed words onto
+     * the running class scores. Inlined into its callers so that a constant
+     * num_words gives loops of known length.
+     * @param table one row of Scorer::kClassStride doubles per bit
+     * @param words packed pixels, see Sample::GetPackedPixels()
+     * @param num_words
+     * @param scores running scores, updated in place
+     * @param mask if not null, only bits also set in the mask are visited
+     */
+    inline void AccumulateRows(const double* table, const uint64_t* words, size_t num_words,
+                               double scores[Scorer::kClassStride], const uint64_t* mask = nullptr) {
+        const size_t stride = Scorer::kClassStride;
+#if defined(__AVX__)
+        __m256d a0 = _mm256_loadu_pd(scores);
+        __m256d a1 = _mm256_loadu_pd(scores + 4);
+        __m256d a2 = _mm256_loadu_pd(scores + 8);
+        for (size_t w = 0; w < num_words; w++) {
+            for (uint64_t bits = mask != nullptr ? words[w] & mask[w] : words[w]; bits != 0; bits &= bits - 1) {
+                const double* row = table + (w * Sample::kWordBits + CountTrailingZeros(bits)) * stride;
+                a0 = _mm256_add_pd(a0, _mm256_loadu_pd(row));
+                a1 = _mm256_add_pd(a1, _mm256_loadu_pd(row + 4));
+                a2 = _mm256_add_pd(a2, _mm256_loadu_pd(row + 8));
+            }
+        }
+        _mm256_storeu_pd(scores, a0);
+        _mm256_storeu_pd(scores + 4, a1);
+        _mm256_storeu_pd(scores + 8, a2);
+#elif defined(__SSE2__)
+        __m128d a[6];
+        for (size_t k = 0; k < 6; k++) {
+            a[k] = _mm_loadu_pd(scores + 2 * k);
+        }
+        for (size_t w = 0; w < num_words; w++) {
+            for (uint64_t bits = mask != nullptr ? words[w] & mask[w] : words[w]; bits != 0; bits &= bits - 1) {
+                const double* row = table + (w * Sample::kWordBits + CountTrailingZeros(bits)) * stride;
+                for (size_t k = 0; k < 6; k++) {
+                    a[k] = _mm_add_pd(a[k], _mm_loadu_pd(row + 2 * k));
+                }
+            }
+        }
+        for (size_t k = 0; k < 6; k++) {
+            _mm_storeu_pd(scores + 2 * k, a[k]);
+        }
+#else
+        for (size_t w = 0; w < num_words; w++) {
+            for (uint64_t bits = mask != nullptr ? words[w] & mask[w] : words[w]; bits != 0; bits &= bits - 1) {
+                const double* row = table + (w * Sample::kWordBits + CountTrailingZeros(bits)) * stride;
+                for (size_t c = 0; c < stride; c++) {
+                    scores[c] += row[c];
+                }
+            }
+        }
+#endif
+    }
+}
+
+#endif //NAIVE_BAYES_SCORE_KERNEL_H
@@ -0,0 +1,143 @@
+#ifndef NAIVE_BAYES_SCORER_H
+#define NAIVE_BAYES_SCORER_H
+
+#include <vector>
+#include "core/aligned_allocator.h"
+#include "core/sample.h"
+
+namespace naivebayes {
+    /**
+     * Log-space scoring tables for a trained model. Summing log probabilities
+     * instead of multiplying raw ones keeps the class scores far away from the
+     * denormal range, so the argmax no longer depends on underflow.
+     *
+     * Every score starts from the log prior plus the log likelihood of a blank
+     * image, so only the shaded pixels of a sample have to be visited. The delta
+     * table is pixel-major with all classes of a pixel interleaved in one row, so
+     * each shaded pixel costs one contiguous, aligned row of loads. With more than
+     * two shades there is one block of rows per shade above 0, in the order of the
+     * sample's bit planes, so a set bit selects its row whatever its shade.
+     */
+    class Scorer {
+    public:
+        static const int kClasses = 10;
+        // Classes per table row, padded to a multiple of the widest SIMD register (4 doubles)
+        static const int kClassStride = 12;
+
+        /**
+         * Constructor
+         */
+        Scorer();
+
+        /**
+         * This method precomputes the log tables from the probabilities of a model.
+         * @param prior prior of every class
+         * @param likelihood likelihood of every class, shade and pixel, in [class][shade][pixel] order
+         * @param num_pixels dimension of the samples
+         * @param num_shades number of shades a pixel can take
+         */
+        void Build(const double prior[10], const double* likelihood, int num_pixels, int num_shades);
+
+        /**
+         * This method recomputes the tables of one class after its likelihoods changed.
+         * The tables must have been built for the same dimensions before.
+         * @param digit class to update
+         * @param likelihood likelihood of every shade and pixel of that class, in [shade][pixel] order
+         */
+        void UpdateClass(int digit, const double* likelihood);
+
+        /**
+         * This method replaces the priors of every class.
+         * @param prior
+         */
+        void SetPriors(const double prior[10]);
+
+        /**
+         * This method scores a sample against every class.
+         * @param sample
+         * @param scores receives the log posterior (up to a constant) of every class
+         * @return the class with the highest score, or -1 if the sample does not fit the tables
+         */
+        int Score(const Sample& sample, double scores[kClassStride]) const;
+
+        /**
+         * This method restricts scoring to a subset of the pixels. The tables must
+         * already treat the other pixels as uninformative (zero deltas, see
+         * Model::SelectPixels()), so the scores do not change; the set bits of the
+         * other pixels are just never visited. Building or replacing the tables
+         * drops the selection.
+         * @param pixels indices of the pixels to score, in row major order; empty for all
+         */
+        void Select(const vector<uint32_t>& pixels);
+
+        /**
+         * This method replaces the tables with ones computed earlier, e.g. by a saved model.
+         * @param num_pixels dimension of the samples
+         * @param num_shades number of shades a pixel can take
+         * @param blank_scores kClassStride doubles, see GetBlankScores()
+         * @param deltas (num_shades - 1) * num_pixels^2 * kClassStride doubles, see GetDeltas()
+         */
+        void Assign(int num_pixels, int num_shades, const double* blank_scores, const double* deltas);
+
+        /**
+         * This method makes the scorer read its delta table from memory it does not
+         * own, such as a memory mapped model file. The memory must outlive the scorer.
+         * @param num_pixels dimension of the samples
+         * @param num_shades number of shades a pixel can take
+         * @param blank_scores kClassStride doubles, copied
+         * @param deltas (num_shades - 1) * num_pixels^2 * kClassStride doubles, used in place
+         */
+        void View(int num_pixels, int num_shades, const double* blank_scores, const double* deltas);
+
+        /**
+         * This method returns the dimension of the samples the tables were built for.
+         * @return int
+         */
+        int GetSampleLength() const;
+
+        /**
+         * This method returns the number of shades the tables were built for.
+         * @return int
+         */
+        int GetNumShades() const;
+
+        /**
+         * This method returns the score of a blank image for each class.
+         * @return kClassStride doubles
+         */
+        const double* GetBlankScores() const;
+
+        /**
+         * This method returns the shaded minus unshaded table, one row of kClassStride
+         * doubles per pixel and shade above 0, shade-major.
+         * @return table of (num_shades - 1) * num_pixels^2 * kClassStride doubles
+         */
+        const double* GetDeltas() const;
+
+        /**
+         * This method returns the rows Select() restricted scoring to.
+         * @return one bit per table row in the layout of Sample::GetPackedPixels(),
+         *         or null when every row is scored
+         */
+        const uint64_t* GetRowMask() const;
+
+    private:
+        int num_pixels_;
+        int num_shades_;
+        // Log prior plus the log likelihood of every pixel being unshaded
+        double log_blank_[kClassStride];
+        // The two parts of log_blank_, kept so that one of them can be updated on its own
+        double log_prior_[kClassStride];
+        double log_unshaded_[kClassStride];
+        // [shade - 1][pixel][class], shaded minus unshaded log likelihood, kClassStride doubles per row
+        AlignedVector<double> log_delta_;
+        // Delta table in memory owned by someone else, see View()
+        const double* external_delta_;
+
+        // One bit per table row, set for the rows of the selected pixels, see Select().
+        // Empty when every pixel is scored.
+        std::vector<uint64_t> row_mask_;
+    };
+}
+
+#endif //NAIVE_BAYES_SCORER_H
@@ -0,0 +1,91 @@
+#ifndef NAIVE_BAYES_STATUS_H
+#define NAIVE_BAYES_STATUS_H
+
+#include <string>
+
+namespace naivebayes {
+    /**
+     * Kinds of outcome a Status reports.
+     *  kOk:                nothing went wrong
+     *  kEndOfInput:        a reader has no more records, not an error on its own
+     *  kIoError:           a file could not be opened, read or written
+     *  kFormatError:       a record or a model file is malformed, unsupported or corrupt
+     *  kDimensionMismatch: a sample does not have the dimension or shades of the model
+     *  kInvalidModel:      the model is not trained, or lacks what the operation needs
+     *  kInvalidArgument:   an argument is out of range
+     */
+    enum StatusCode {
+        kOk,
+        kEndOfInput,
+        kIoError,
+        kFormatError,
+        kDimensionMismatch,
+        kInvalidModel,
+        kInvalidArgument
+    };
+
+    /**
+     * Outcome of an operation: a code and, unless it is kOk, a message saying
+     * what went wrong and where. An ok Status holds no message, so returning
+     * one costs no allocation.
+     */
+    class Status {
+    public:
+        /**
+         * Constructor of an ok status.
+         */
+        Status();
+        explicit Status(StatusCode code, const std::string& message = std::string());
+
+        bool IsOk() const;
+        StatusCode GetCode() const;
+        const std::string& GetMessage() const;
+
+        /**
+         * This method describes the status for people, e.g. "format error: ...".
+         * @return string
+         */
+        std::string ToString() const;
+
+    private:
+        StatusCode code_;
+        std::string message_;
+    };
+
+    /**
+     * A value, or the Status saying why there is none.
+     */
+    template <typename T>
+    class Result {
+    public:
+        Result(const T& value) : value_(value) {}
+
+        /**
+         * Constructor of a failed result.
+         * @param status must not be ok
+         */
+        Result(const Status& status) : status_(status), value_() {}
+
+        bool IsOk() const {
+            return status_.IsOk();
+        }
+
+        const Status& GetStatus() const {
+            return status_;
+        }
+
+        /**
+         * This method returns the value, which is only meaningful when IsOk().
+         * @return value
+         */
+        const T& GetValue() const {
+            return value_;
+        }
+
+    private:
+        Status status_;
+        T value_;
+    };
+}
+
+#endif //NAIVE_BAYES_STATUS_H
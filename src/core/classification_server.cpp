@@ -0,0 +1,354 @@
+#include "core/classification_server.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include "core/logger.h"
+#include "core/sample_reader.h"
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace naivebayes {
+    namespace {
+        // How often blocked reads and accepts look at the stop flag
+        const int kPollMilliseconds = 100;
+        const size_t kReadSize = 1 << 16;
+    }
+
+    ClassificationServer::ClassificationServer(Model& model, RequestFormat format, size_t max_batch)
+            : model_(model), sample_length_(-1), num_shades_(2), format_(format),
+              max_batch_(std::max<size_t>(max_batch, 1)), stop_(false), closed_(false), queue_head_(0),
+              queue_size_(0), num_free_(0), latency_total_(0), next_latency_(0) {
+        memset(&stats_, 0, sizeof(stats_));
+    }
+
+    int ClassificationServer::Serve(int input_fd, int output_fd) {
+#if defined(_WIN32)
+        NAIVE_BAYES_LOG(kLogError, "Serving is only supported on POSIX systems");
+        return 0;
+#else
+        if (model_.GetSampleLength() < 0) {
+            NAIVE_BAYES_LOG(kLogError, "Cannot serve requests without a valid model");
+            return 0;
+        }
+        Clock::time_point start = Clock::now();
+        sample_length_ = model_.GetSampleLength();
+        num_shades_ = model_.GetNumShades();
+        closed_ = false;
+        latencies_.reserve(kLatencyWindow);
+        // The reader starts on batch 0, every other batch is free
+        queue_head_ = 0;
+        queue_size_ = 0;
+        num_free_ = 0;
+        for (size_t i = kNumBatches - 1; i > 0; i--) {
+            free_batches_[num_free_++] = i;
+        }
+        batches_[0].size = 0;
+        batches_[0].arrivals.clear();
+        batches_[0].end = false;
+        std::thread reader(&ClassificationServer::ReadRequests, this, input_fd);
+        while (true) {
+            size_t index = PopBatch();
+            Batch& batch = batches_[index];
+            if (!closed_ && batch.size != 0 && !AnswerBatch(batch, output_fd)) {
+                // Keep draining the queue so the reader is never left waiting on it
+                closed_ = true;
+            }
+            bool end = batch.end;
+            ReleaseBatch(index);
+            if (end) {
+                break;
+            }
+        }
+        reader.join();
+        stats_.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+        return 1;
+#endif
+    }
+
+    int ClassificationServer::ServeSocket(const std::string& path) {
+#if defined(_WIN32)
+        NAIVE_BAYES_LOG(kLogError, "Serving is only supported on POSIX systems");
+        return 0;
+#else
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            NAIVE_BAYES_LOG(kLogError, "Invalid socket path: " << path);
+            return 0;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size());
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            NAIVE_BAYES_LOG(kLogError, "Cannot create socket: " << path);
+            return 0;
+        }
+        // Only a stale socket is replaced, never a file that happens to have the name
+        struct stat existing;
+        if (stat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+            unlink(path.c_str());
+        }
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+            NAIVE_BAYES_LOG(kLogError, "Cannot listen on socket: " << path);
+            close(listener);
+            return 0;
+        }
+        NAIVE_BAYES_LOG(kLogInfo, "Serving on socket: " << path);
+        while (!stop_) {
+            pollfd ready = {listener, POLLIN, 0};
+            if (poll(&ready, 1, kPollMilliseconds) <= 0) {
+                continue;
+            }
+            int connection = accept(listener, nullptr, nullptr);
+            if (connection < 0) {
+                continue;
+            }
+            Serve(connection, connection);
+            close(connection);
+        }
+        close(listener);
+        unlink(path.c_str());
+        return 1;
+#endif
+    }
+
+    void ClassificationServer::Stop() {
+        stop_ = true;
+    }
+
+    void ClassificationServer::ReadRequests(int input_fd) {
+        // Reads go straight to the end of the incomplete request left by the last
+        // one, the buffer only grows for requests larger than a read
+        std::vector<char> pending;
+        pending.reserve(2 * kReadSize);
+        size_t batch = 0;
+#if !defined(_WIN32)
+        while (!stop_ && !closed_) {
+            pollfd ready = {input_fd, POLLIN, 0};
+            int events = poll(&ready, 1, kPollMilliseconds);
+            if (events == 0 || (events < 0 && errno == EINTR)) {
+                continue;
+            }
+            size_t kept = pending.size();
+            pending.resize(kept + kReadSize);
+            ssize_t count = events > 0 ? read(input_fd, pending.data() + kept, kReadSize) : -1;
+            pending.resize(kept + std::max<ssize_t>(count, 0));
+            if (count < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            size_t parsed = ParseRequests(pending.data(), pending.size(), batch, false);
+            pending.erase(pending.begin(), pending.begin() + parsed);
+            // Everything read so far is parsed, answer it rather than wait for a full batch
+            if (batches_[batch].size != 0) {
+                PushBatch(batch);
+            }
+        }
+#endif
+        if (format_ == kAsciiRequests && !pending.empty() && !stop_) {
+            // The last line of the input may have no newline
+            pending.push_back('\n');
+            ParseRequests(pending.data(), pending.size(), batch, true);
+        }
+        batches_[batch].end = true;
+        PushBatch(batch);
+    }
+
+    size_t ClassificationServer::RequestSize(const char* data, size_t size, bool at_end) const {
+        if (format_ == kPackedRequests) {
+            size_t bits = (size_t) (num_shades_ - 1) * sample_length_ * sample_length_;
+            size_t request_size = 1 + (bits + Sample::kWordBits - 1) / Sample::kWordBits * sizeof(uint64_t);
+            return size >= request_size ? request_size : 0;
+        }
+        // The format of SampleReader::Read(): a label line, then as many rows as the first row is long.
+        // A request that breaks it runs up to the next line holding just a digit, where Read() picks
+        // up again, so it gets one answer and the requests after it stay in step.
+        const char* position = data;
+        const char* data_end = data + size;
+        size_t width = 0;
+        bool malformed = false;
+        for (size_t line = 0; ; line++) {
+            const char* newline = static_cast<const char*>(memchr(position, '\n', data_end - position));
+            if (newline == nullptr) {
+                return at_end ? size : 0;
+            }
+            size_t length = newline - position;
+            bool label = length == 1 && *position >= '0' && *position <= '9';
+            if (line == 0) {
+                malformed = !label;
+            } else if (line == 1 && !malformed) {
+                width = length;
+                malformed = length == 0;
+            } else if (!malformed) {
+                malformed = length != width;
+            }
+            if (malformed && label) {
+                return position - data;
+            }
+            position = newline + 1;
+            if (!malformed && line > 0 && line == width) {
+                return position - data;
+            }
+        }
+    }
+
+    size_t ClassificationServer::ParseRequests(const char* data, size_t size, size_t& batch, bool at_end) {
+        size_t parsed = 0;
+        while (true) {
+            // Blank lines between samples are not requests
+            while (format_ == kAsciiRequests && parsed < size && data[parsed] == '\n') {
+                parsed++;
+            }
+            size_t request_size = RequestSize(data + parsed, size - parsed, at_end);
+            if (request_size == 0) {
+                break;
+            }
+            const char* request = data + parsed;
+            Batch* filling = &batches_[batch];
+            if (filling->size == filling->samples.size()) {
+                filling->samples.push_back(Sample());
+            }
+            // Refilled in place, a recycled batch already has the storage of its samples
+            Sample& sample = filling->samples[filling->size];
+            if (format_ == kPackedRequests) {
+                sample.Reset(sample_length_, num_shades_);
+                request_words_.resize(sample.GetPackedPixels().size());
+                memcpy(request_words_.data(), request + 1, request_words_.size() * sizeof(uint64_t));
+                sample.SetPackedPixels(request_words_.data(), request_words_.size());
+                unsigned char label = request[0];
+                sample.SetDigit(label < 10 ? label : -1);
+            } else {
+                SampleReader reader;
+                reader.Attach(request, request + request_size, num_shades_);
+                reader.Next(sample);
+            }
+            filling->size++;
+            filling->arrivals.push_back(Clock::now());
+            parsed += request_size;
+            if (filling->size >= max_batch_) {
+                PushBatch(batch);
+            }
+        }
+        return parsed;
+    }
+
+    void ClassificationServer::PushBatch(size_t& batch) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_changed_.wait(lock, [this] { return queue_size_ < kMaxQueuedBatches && num_free_ != 0; });
+            queue_[(queue_head_ + queue_size_) % kMaxQueuedBatches] = batch;
+            queue_size_++;
+            batch = free_batches_[--num_free_];
+        }
+        queue_changed_.notify_all();
+        batches_[batch].size = 0;
+        batches_[batch].arrivals.clear();
+        batches_[batch].end = false;
+    }
+
+    size_t ClassificationServer::PopBatch() {
+        size_t batch;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_changed_.wait(lock, [this] { return queue_size_ != 0; });
+            batch = queue_[queue_head_];
+            queue_head_ = (queue_head_ + 1) % kMaxQueuedBatches;
+            queue_size_--;
+        }
+        queue_changed_.notify_all();
+        return batch;
+    }
+
+    void ClassificationServer::ReleaseBatch(size_t batch) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            free_batches_[num_free_++] = batch;
+        }
+        queue_changed_.notify_all();
+    }
+
+    bool ClassificationServer::AnswerBatch(Batch& batch, int output_fd) {
+        answers_.clear();
+        for (size_t i = 0; i < batch.size; i++) {
+            int digit = model_.CalculateClassification(batch.samples[i]);
+            answers_ += std::to_string(digit);
+            answers_ += '\n';
+            int label = batch.samples[i].GetDigit();
+            if (label >= 0 && label <= 9) {
+                stats_.labelled++;
+                stats_.correct += digit == label;
+            }
+        }
+#if !defined(_WIN32)
+        // One write per batch
+        size_t written = 0;
+        while (written < answers_.size()) {
+            ssize_t count = write(output_fd, answers_.data() + written, answers_.size() - written);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            written += count;
+        }
+#endif
+        Clock::time_point answered = Clock::now();
+        for (size_t i = 0; i < batch.arrivals.size(); i++) {
+            RecordLatency(std::chrono::duration<double, std::micro>(answered - batch.arrivals[i]).count());
+        }
+        stats_.requests += batch.size;
+        stats_.batches++;
+        return true;
+    }
+
+    void ClassificationServer::RecordLatency(double microseconds) {
+        latency_total_ += microseconds;
+        stats_.max_latency = std::max(stats_.max_latency, microseconds);
+        if (latencies_.size() < kLatencyWindow) {
+            latencies_.push_back(microseconds);
+        } else {
+            latencies_[next_latency_] = microseconds;
+            next_latency_ = (next_latency_ + 1) % kLatencyWindow;
+        }
+    }
+
+    ServerStats ClassificationServer::GetStats() const {
+        ServerStats stats = stats_;
+        if (stats.requests == 0) {
+            return stats;
+        }
+        stats.mean_latency = latency_total_ / stats.requests;
+        std::vector<double> sorted(latencies_);
+        std::sort(sorted.begin(), sorted.end());
+        stats.p50_latency = sorted[sorted.size() / 2];
+        stats.p99_latency = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+        return stats;
+    }
+
+    void ClassificationServer::PrintStats(std::ostream& output) const {
+        ServerStats stats = GetStats();
+        // The output may be the logger's, whose thread must not write in between
+        Logger::Global().Flush();
+        output << "Requests: " << stats.requests << " in " << stats.batches << " batches" << endl;
+        if (stats.seconds > 0) {
+            output << "Throughput: " << stats.requests / stats.seconds << " requests/s" << endl;
+        }
+        output << "Latency (us): mean " << stats.mean_latency << ", p50 " << stats.p50_latency
+               << ", p99 " << stats.p99_latency << ", max " << stats.max_latency << endl;
+        if (stats.labelled > 0) {
+            output << "Accuracy on labelled requests: " << stats.correct * 1.0 / stats.labelled << endl;
+        }
+    }
+}
@@ -0,0 +1,173 @@
+#include "core/cross_validation.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace naivebayes {
+    double FoldResult::GetAccuracy() const {
+        size_t passed = 0;
+        size_t total = 0;
+        for (int d = 0; d < 10; d++) {
+            passed += passed_digit[d];
+            total += total_digit[d];
+        }
+        return total > 0 ? passed * 1.0 / total : 0;
+    }
+
+    double FoldResult::GetDigitAccuracy(int digit) const {
+        return total_digit[digit] > 0 ? passed_digit[digit] * 1.0 / total_digit[digit] : 0;
+    }
+
+    CrossValidator::CrossValidator(int num_shades) : num_shades_(num_shades), num_skipped_(0) {}
+
+    Status CrossValidator::Open(const std::string& fileName, size_t num_folds, size_t num_threads) {
+        fold_records_.clear();
+        fold_models_.clear();
+        total_.reset();
+        num_skipped_ = 0;
+        Status status = index_.Load(fileName, SampleIndex::GetSidecarName(fileName), num_shades_);
+        if (!status.IsOk()) {
+            status = index_.Build(fileName, num_shades_);
+            if (!status.IsOk()) {
+                return status;
+            }
+        }
+        size_t num_records = index_.GetNumRecords();
+        if (num_folds < 2 || num_folds > num_records) {
+            return Status(kInvalidArgument, "Cross-validation needs between 2 and " + std::to_string(num_records) +
+                                            " folds for file: " + fileName);
+        }
+
+        // The samples of every digit are dealt in turn, carrying on where the previous digit stopped,
+        // so folds differ by at most one sample overall and per digit
+        std::vector<size_t> fold_of(num_records);
+        size_t next = 0;
+        for (int d = 0; d < 10; d++) {
+            const std::vector<size_t>& records = index_.GetRecordsOfDigit(d);
+            for (size_t i = 0; i < records.size(); i++) {
+                fold_of[records[i]] = next++ % num_folds;
+            }
+        }
+        std::vector<std::vector<size_t>> fold_records(num_folds);
+        for (size_t r = 0; r < num_records; r++) {
+            fold_records[fold_of[r]].push_back(r);
+        }
+
+        // Samples are checked against the first, threads would otherwise each go by their own first sample
+        Sample first;
+        index_.GetReader(0, 1).Read(first);
+        int num_pixels = first.GetSampleLength();
+
+        // Every thread reads a run of the file and counts it into one model per fold of its own
+        num_threads = std::max<size_t>(1, std::min(num_threads, num_records));
+        std::vector<std::vector<Model>> thread_models(num_threads, std::vector<Model>(num_folds, Model(num_shades_)));
+        std::vector<size_t> skipped(num_threads, 0);
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < num_threads; t++) {
+            workers.push_back(std::thread(&CrossValidator::CountRecords, this, t * num_records / num_threads,
+                                          (t + 1) * num_records / num_threads, num_pixels, std::cref(fold_of),
+                                          &thread_models[t], &skipped[t]));
+        }
+        CountRecords(0, num_records / num_threads, num_pixels, fold_of, &thread_models[0], &skipped[0]);
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+
+        std::vector<Model> fold_models(num_folds, Model(num_shades_));
+        std::unique_ptr<Model> total(new Model(num_shades_));
+        for (size_t f = 0; f < num_folds; f++) {
+            for (size_t t = 0; t < num_threads; t++) {
+                if (!fold_models[f].Merge(thread_models[t][f]).IsOk()) {
+                    return Status(kDimensionMismatch, "Samples of different sizes in file: " + fileName);
+                }
+            }
+            if (!total->Merge(fold_models[f]).IsOk()) {
+                return Status(kDimensionMismatch, "Samples of different sizes in file: " + fileName);
+            }
+        }
+        for (size_t t = 0; t < num_threads; t++) {
+            num_skipped_ += skipped[t];
+        }
+        fold_records_.swap(fold_records);
+        fold_models_.swap(fold_models);
+        total_.swap(total);
+        return Status();
+    }
+
+    size_t CrossValidator::GetNumFolds() const {
+        return fold_records_.size();
+    }
+
+    const std::vector<size_t>& CrossValidator::GetFoldRecords(size_t fold) const {
+        return fold_records_[fold];
+    }
+
+    size_t CrossValidator::GetSkippedRecords() const {
+        return num_skipped_;
+    }
+
+    void CrossValidator::CountRecords(size_t first, size_t last, int num_pixels, const std::vector<size_t>& fold_of,
+                                      std::vector<Model>* models, size_t* num_skipped) const {
+        SampleReader reader = index_.GetReader(first, last);
+        Sample sample;
+        for (size_t r = first; r < last; r++) {
+            Status status = reader.ReadAt(index_.GetOffset(r), sample);
+            if (status.IsOk() && sample.GetSampleLength() == num_pixels) {
+                status = (*models)[fold_of[r]].ProcessSample(sample);
+            } else {
+                status = Status(kDimensionMismatch);
+            }
+            if (!status.IsOk()) {
+                (*num_skipped)++;
+            }
+        }
+    }
+
+    Result<std::vector<FoldResult>> CrossValidator::Evaluate(double laplace, size_t num_threads) const {
+        if (!total_) {
+            return Status(kInvalidModel, "Cross-validation has no samples, see Open()");
+        }
+        if (!(laplace > 0)) {
+            return Status(kInvalidArgument, "Smoothing must be positive");
+        }
+        size_t num_folds = fold_records_.size();
+        std::vector<FoldResult> results(num_folds);
+        num_threads = std::max<size_t>(1, std::min(num_threads, num_folds));
+        // Folds are independent: each one copies the total counts and subtracts its own
+        auto evaluate = [this, laplace, num_threads, num_folds, &results](size_t t) {
+            for (size_t f = t; f < num_folds; f += num_threads) {
+                EvaluateFold(f, laplace, &results[f]);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < num_threads; t++) {
+            workers.push_back(std::thread(evaluate, t));
+        }
+        evaluate(0);
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+        return results;
+    }
+
+    void CrossValidator::EvaluateFold(size_t fold, double laplace, FoldResult* result) const {
+        Model model(*total_);
+        model.Subtract(fold_models_[fold]);
+        model.SetLaplace(laplace);
+        result->num_trained = model.GetSampleTotals();
+        SampleReader reader = index_.GetReader(0, index_.GetNumRecords());
+        Sample sample;
+        const std::vector<size_t>& records = fold_records_[fold];
+        for (size_t i = 0; i < records.size(); i++) {
+            if (!reader.ReadAt(index_.GetOffset(records[i]), sample).IsOk()) {
+                continue;
+            }
+            Result<int> digit = model.Predict(sample);
+            if (!digit.IsOk()) {
+                continue;
+            }
+            result->total_digit[sample.GetDigit()]++;
+            result->passed_digit[sample.GetDigit()] += digit.GetValue() == sample.GetDigit();
+        }
+    }
+}
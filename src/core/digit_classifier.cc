@@ -1,4 +1,5 @@
 #include <core/digit_classifier.h>
+#include <core/logger.h>
 #include <iostream>
 #include <fstream>
 
@@ -15,12 +16,12 @@ namespace naivebayes {
     }
 
     int DigitClassifier::LoadModel(std::string fileName) {
-        cout << "Digit_classifier loading model from file: " << fileName << endl;
+        NAIVE_BAYES_LOG(kLogInfo, "Digit_classifier loading model from file: " << fileName);
         return model_.Load(fileName);
     }
 
     int DigitClassifier::SaveModel(std::string fileName) {
-        cout << "Digit_classifier saving model from file: " << fileName << endl;
+        NAIVE_BAYES_LOG(kLogInfo, "Digit_classifier saving model from file: " << fileName);
         return model_.Save(fileName);
     }
 
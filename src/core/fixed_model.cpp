@@ -0,0 +1,77 @@
+#include "core/fixed_model.h"
+#include "core/score_kernel.h"
+
+#include <algorithm>
+
+namespace naivebayes {
+    template <int Side, int Shades, int Classes>
+    FixedModel<Side, Shades, Classes>::FixedModel(const double* blank_scores, const double* deltas,
+                                                  const uint64_t* row_mask) {
+        std::copy(blank_scores, blank_scores + log_blank_.size(), log_blank_.begin());
+        std::copy(deltas, deltas + log_delta_.size(), log_delta_.begin());
+        if (row_mask != nullptr) {
+            std::copy(row_mask, row_mask + kWords, row_mask_.begin());
+        } else {
+            row_mask_.fill(~(uint64_t) 0);
+        }
+    }
+
+    template <int Side, int Shades, int Classes>
+    int FixedModel<Side, Shades, Classes>::Score(const Sample& sample, double scores[Scorer::kClassStride]) const {
+        for (int c = 0; c < Scorer::kClassStride; c++) {
+            scores[c] = log_blank_[c];
+        }
+        // kWords is a constant here, unlike the runtime scorer's sample length
+        AccumulateRows(log_delta_.data(), sample.GetPackedPixels().data(), kWords, scores, row_mask_.data());
+
+        int best = 0;
+        for (int c = 1; c < Classes; c++) {
+            if (scores[c] > scores[best]) {
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    template <int Side, int Shades, int Classes>
+    int FixedModel<Side, Shades, Classes>::GetSampleLength() const {
+        return Side;
+    }
+
+    template <int Side, int Shades, int Classes>
+    int FixedModel<Side, Shades, Classes>::GetNumShades() const {
+        return Shades;
+    }
+
+    template <int Side, int Shades, int Classes>
+    void FixedModel<Side, Shades, Classes>::UpdateClass(int digit, const double* deltas) {
+        for (size_t row = 0; row < kRows; row++) {
+            log_delta_[row * Scorer::kClassStride + digit] = deltas[row * Scorer::kClassStride + digit];
+        }
+    }
+
+    template <int Side, int Shades, int Classes>
+    void FixedModel<Side, Shades, Classes>::SetBlankScores(const double* blank_scores) {
+        std::copy(blank_scores, blank_scores + log_blank_.size(), log_blank_.begin());
+    }
+
+    template <int Side, int Shades, int Classes>
+    std::shared_ptr<FixedModelBase> FixedModel<Side, Shades, Classes>::Clone() const {
+        return std::make_shared<FixedModel>(*this);
+    }
+
+    // The sizes the deployment classifies; any other size uses the runtime Scorer
+    template class FixedModel<28, 2, Scorer::kClasses>;
+    template class FixedModel<28, 3, Scorer::kClasses>;
+
+    std::shared_ptr<FixedModelBase> MakeFixedModel(int num_pixels, int num_shades, const double* blank_scores,
+                                                         const double* deltas, const uint64_t* row_mask) {
+        if (num_pixels == 28 && num_shades == 2) {
+            return std::make_shared<FixedModel<28, 2, Scorer::kClasses>>(blank_scores, deltas, row_mask);
+        }
+        if (num_pixels == 28 && num_shades == 3) {
+            return std::make_shared<FixedModel<28, 3, Scorer::kClasses>>(blank_scores, deltas, row_mask);
+        }
+        return std::shared_ptr<FixedModelBase>();
+    }
+}
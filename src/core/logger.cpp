@@ -0,0 +1,81 @@
+#include "core/logger.h"
+
+#include <iostream>
+
+namespace naivebayes {
+    std::atomic<int> Logger::level_(kLogInfo);
+
+    Logger::Logger() : output_(&std::cout), stop_(false), writing_(false) {}
+
+    Logger::~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        changed_.notify_all();
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+    }
+
+    Logger& Logger::Global() {
+        static Logger logger;
+        return logger;
+    }
+
+    void Logger::SetLevel(LogLevel level) {
+        level_ = level;
+    }
+
+    LogLevel Logger::GetLevel() {
+        return static_cast<LogLevel>(level_.load());
+    }
+
+    void Logger::Write(const std::string& message) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // The writer is started by the first message, programs that log nothing never have one
+            if (!writer_.joinable()) {
+                writer_ = std::thread(&Logger::WriteMessages, this);
+            }
+            changed_.wait(lock, [this] { return queue_.size() < kMaxQueuedMessages; });
+            queue_.push_back(message);
+        }
+        changed_.notify_all();
+    }
+
+    void Logger::Flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return queue_.empty() && !writing_; });
+    }
+
+    void Logger::SetOutput(std::ostream* output) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return queue_.empty() && !writing_; });
+        output_ = output;
+    }
+
+    void Logger::WriteMessages() {
+        std::vector<std::string> messages;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            changed_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                break;
+            }
+            messages.swap(queue_);
+            writing_ = true;
+            std::ostream* output = output_;
+            lock.unlock();
+            changed_.notify_all();
+            for (size_t i = 0; i < messages.size(); i++) {
+                *output << messages[i] << '\n';
+            }
+            output->flush();
+            messages.clear();
+            lock.lock();
+            writing_ = false;
+            changed_.notify_all();
+        }
+    }
+}
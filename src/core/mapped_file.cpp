@@ -0,0 +1,81 @@
+#include "core/mapped_file.h"
+
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace naivebayes {
+    MappedFile::MappedFile() : data_(nullptr), size_(0) {}
+
+    MappedFile::~MappedFile() {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string& fileName) {
+        Close();
+#if !defined(_WIN32)
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return false;
+        }
+        size_ = info.st_size;
+        if (size_ > 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                size_ = 0;
+                close(fd);
+                return false;
+            }
+            madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+        }
+        // The mapping stays valid after the descriptor is closed
+        close(fd);
+        return true;
+#else
+        std::ifstream my_file(fileName, std::ios::binary | std::ios::ate);
+        if (!my_file.is_open()) {
+            return false;
+        }
+        buffer_.resize(static_cast<size_t>(my_file.tellg()));
+        my_file.seekg(0);
+        if (!my_file.read(buffer_.data(), buffer_.size())) {
+            buffer_.clear();
+            return false;
+        }
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        return true;
+#endif
+    }
+
+    void MappedFile::Close() {
+#if !defined(_WIN32)
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+#else
+        buffer_.clear();
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    const char* MappedFile::GetData() const {
+        return data_;
+    }
+
+    size_t MappedFile::GetSize() const {
+        return size_;
+    }
+}
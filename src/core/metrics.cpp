@@ -0,0 +1,127 @@
+#include "core/metrics.h"
+
+namespace naivebayes {
+    namespace {
+        const char* const kPhaseNames[kNumPhases] = {"open", "parse", "train", "build_tables", "score", "load", "save"};
+        const char* const kCounterNames[kNumCounters] = {"samples_parsed", "bytes_read", "samples_trained",
+                                                          "samples_classified", "invalid_samples"};
+
+        // Upper bound of a latency bucket in seconds
+        double BucketBound(size_t bucket) {
+            return (uint64_t(1) << (bucket + Metrics::kFirstBucketBits)) * 1e-9;
+        }
+    }
+
+    std::atomic<bool> Metrics::enabled_(false);
+
+    Metrics::Metrics() {
+        Reset();
+    }
+
+    Metrics& Metrics::Global() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    void Metrics::SetEnabled(bool enabled) {
+        enabled_ = enabled;
+    }
+
+    void Metrics::AddTime(MetricPhase phase, uint64_t nanoseconds) {
+        phase_nanoseconds_[phase].fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    void Metrics::AddCount(MetricCounter counter, uint64_t count) {
+        counts_[counter].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void Metrics::RecordLatency(uint64_t nanoseconds) {
+        size_t bucket = 0;
+        while (bucket + 1 < kLatencyBuckets && (nanoseconds >> (bucket + kFirstBucketBits)) != 0) {
+            bucket++;
+        }
+        latency_buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        latency_count_.fetch_add(1, std::memory_order_relaxed);
+        latency_nanoseconds_.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    uint64_t Metrics::GetTime(MetricPhase phase) const {
+        return phase_nanoseconds_[phase];
+    }
+
+    uint64_t Metrics::GetCount(MetricCounter counter) const {
+        return counts_[counter];
+    }
+
+    uint64_t Metrics::GetLatencyCount() const {
+        return latency_count_;
+    }
+
+    void Metrics::Reset() {
+        for (size_t i = 0; i < kNumPhases; i++) {
+            phase_nanoseconds_[i] = 0;
+        }
+        for (size_t i = 0; i < kNumCounters; i++) {
+            counts_[i] = 0;
+        }
+        for (size_t i = 0; i < kLatencyBuckets; i++) {
+            latency_buckets_[i] = 0;
+        }
+        latency_count_ = 0;
+        latency_nanoseconds_ = 0;
+    }
+
+    void Metrics::WriteJson(std::ostream& output) const {
+        output << "{\n  \"phase_seconds\": {";
+        for (size_t i = 0; i < kNumPhases; i++) {
+            output << (i == 0 ? "" : ", ") << "\"" << kPhaseNames[i] << "\": " << phase_nanoseconds_[i] * 1e-9;
+        }
+        output << "},\n  \"counters\": {";
+        for (size_t i = 0; i < kNumCounters; i++) {
+            output << (i == 0 ? "" : ", ") << "\"" << kCounterNames[i] << "\": " << counts_[i];
+        }
+        output << "},\n  \"classification_latency\": {\"count\": " << latency_count_
+               << ", \"sum_seconds\": " << latency_nanoseconds_ * 1e-9 << ", \"buckets\": [";
+        // Cumulative, the same way the Prometheus histogram is
+        uint64_t total = 0;
+        for (size_t i = 0; i < kLatencyBuckets; i++) {
+            total += latency_buckets_[i];
+            output << (i == 0 ? "" : ", ") << "{\"le_seconds\": ";
+            if (i + 1 < kLatencyBuckets) {
+                output << BucketBound(i);
+            } else {
+                output << "\"+Inf\"";
+            }
+            output << ", \"count\": " << total << "}";
+        }
+        output << "]}\n}\n";
+    }
+
+    void Metrics::WritePrometheus(std::ostream& output) const {
+        output << "# HELP naivebayes_phase_seconds_total Time spent in each phase of training and classification.\n";
+        output << "# TYPE naivebayes_phase_seconds_total counter\n";
+        for (size_t i = 0; i < kNumPhases; i++) {
+            output << "naivebayes_phase_seconds_total{phase=\"" << kPhaseNames[i] << "\"} "
+                   << phase_nanoseconds_[i] * 1e-9 << "\n";
+        }
+        for (size_t i = 0; i < kNumCounters; i++) {
+            output << "# TYPE naivebayes_" << kCounterNames[i] << "_total counter\n";
+            output << "naivebayes_" << kCounterNames[i] << "_total " << counts_[i] << "\n";
+        }
+        output << "# HELP naivebayes_classification_latency_seconds Latency of classifying one sample.\n";
+        output << "# TYPE naivebayes_classification_latency_seconds histogram\n";
+        uint64_t total = 0;
+        for (size_t i = 0; i < kLatencyBuckets; i++) {
+            total += latency_buckets_[i];
+            output << "naivebayes_classification_latency_seconds_bucket{le=\"";
+            if (i + 1 < kLatencyBuckets) {
+                output << BucketBound(i);
+            } else {
+                output << "+Inf";
+            }
+            output << "\"} " << total << "\n";
+        }
+        output << "naivebayes_classification_latency_seconds_sum " << latency_nanoseconds_ * 1e-9 << "\n";
+        output << "naivebayes_classification_latency_seconds_count " << latency_count_ << "\n";
+    }
+}
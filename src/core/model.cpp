@@ -4,100 +4,368 @@
 
 #include "core/model.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include "core/logger.h"
+#include "core/sample_index.h"
+
 namespace naivebayes {
-    Model::Model() {
+    Model::Model(int num_shades) {
         train_total_ = 0;
         num_pixels_ = -1;
-        pixel_class_count_.resize(10);
-        for (size_t s = 0; s < 10; s++) {
-            pixel_class_count_[s].resize(2);
+        num_shades_ = num_shades >= 2 && num_shades <= Sample::kMaxShades ? num_shades : 2;
+        laplace_ = 1.0;
+        skipped_records_ = 0;
+        mapped_likelihood_ = nullptr;
+        model_dirty_ = false;
+        for (size_t i = 0; i < 10; i++) {
+            train_class_total_[i] = 0;
+            class_dirty_[i] = false;
         }
-        for (size_t i = 0; i < 10; i++) train_class_total_[i] = 0;
     }
 
-    void Model::BuildModel(std::string fileName) {
-        ifstream my_file;
-        my_file.open(fileName);
-        if (!my_file || !my_file.is_open()) {
-            cout << "File open error: " << fileName << std::endl;
-            return;
+    Status Model::TrainFile(const string& fileName, size_t num_threads, RecordPolicy policy) {
+        skipped_records_ = 0;
+        if (num_pixels_ >= 0 && pixel_class_count_.empty()) {
+            return Status(kInvalidModel, "Model has no training counts to add to");
         }
-        cout << "Building model from file: " << fileName << endl;
+        SampleReader reader;
+        Status status = OpenSamples(fileName, reader);
+        if (!status.IsOk()) {
+            return status;
+        }
+        NAIVE_BAYES_LOG(kLogInfo, "Building model from file: " << fileName);
 
-        while (!my_file.eof()) {
-            Sample sample;
-            my_file >> sample;
-            if (sample.GetSampleLength() == sample.kSampleIgnore) {
-                break;
+        if (num_threads <= 1) {
+            status = ProcessSamples(reader, policy);
+        } else {
+            if (num_pixels_ < 0) {
+                // Every shard has to check its samples against the same dimension
+                SampleReader first = reader;
+                Sample sample;
+                Status record;
+                while ((record = first.Read(sample)).GetCode() == kFormatError) {}
+                if (record.IsOk()) {
+                    StartCounts(sample.GetSampleLength());
+                }
             }
-            ProcessSample(sample);
-            if (GetSampleLength() < 0) {
-                cout << "Invalid model \n";
-                num_pixels_ = -1;
-                return;
+            // Every shard counts a contiguous run of records into a private model
+            vector<SampleReader> parts = SplitSamples(fileName, reader, num_threads);
+            vector<Model> shards(parts.size(), Model(num_shades_));
+            vector<std::thread> workers;
+            for (size_t t = 0; t < parts.size(); t++) {
+                if (num_pixels_ >= 0) {
+                    shards[t].StartCounts(num_pixels_);
+                }
+                workers.push_back(std::thread(&Model::BuildShard, &shards[t], parts[t], policy));
+            }
+            for (size_t t = 0; t < workers.size(); t++) {
+                workers[t].join();
             }
+            // Shards are merged in file order, integer counts make this identical to the serial build
+            for (size_t t = 0; t < shards.size() && status.IsOk(); t++) {
+                skipped_records_ += shards[t].skipped_records_;
+                status = shards[t].shard_status_;
+                if (status.IsOk()) {
+                    status = AddCounts(shards[t]);
+                }
+            }
+        }
+        if (!status.IsOk()) {
+            num_pixels_ = -1;
+            return status;
+        }
+        if (skipped_records_ > 0) {
+            NAIVE_BAYES_LOG(kLogWarning, "Skipped " << skipped_records_ << " bad samples in file: " << fileName);
         }
         BuildPrior();
         BuildLikelihood();
+        return status;
+    }
 
-        my_file.close();
+    size_t Model::GetSkippedRecords() const {
+        return skipped_records_;
+    }
+
+    void Model::BuildModel(std::string fileName, size_t num_threads) {
+        Status status = TrainFile(fileName, num_threads, kStopOnBadRecord);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(kLogError, status.GetMessage());
+        }
+    }
+
+    Status Model::OpenSamples(const string& fileName, SampleReader& reader) const {
+        PhaseTimer timer(kOpenPhase);
+        if (!reader.Open(fileName, num_shades_)) {
+            return Status(kIoError, "File open error: " + fileName);
+        }
+        if (Metrics::IsEnabled()) {
+            Metrics::Global().AddCount(kBytesRead, reader.GetSize());
+        }
+        return Status();
+    }
+
+    vector<SampleReader> Model::SplitSamples(const string& fileName, const SampleReader& reader,
+                                             size_t num_parts) const {
+        if (num_parts > 1) {
+            SampleIndex index;
+            if (index.Load(fileName, SampleIndex::GetSidecarName(fileName), num_shades_).IsOk()) {
+                return index.Split(num_parts);
+            }
+        }
+        return reader.Split(num_parts);
+    }
+
+    void Model::StartCounts(int num_pixels) {
+        num_pixels_ = num_pixels;
+        pixel_class_count_.assign(TableIndex(kDigits, 0, 0), 0);
+        selected_pixels_.clear();
+    }
+
+    Status Model::ProcessSamples(SampleReader& reader, RecordPolicy policy) {
+        // Times and counts are kept here and reported once, shards run on several threads
+        bool timed = Metrics::IsEnabled();
+        uint64_t parse_time = 0;
+        uint64_t train_time = 0;
+        size_t parsed = 0;
+        size_t invalid = 0;
+        Status status;
+        Sample sample;
+        uint64_t start = timed ? Metrics::Now() : 0;
+        while (true) {
+            Status record = reader.Read(sample);
+            if (record.GetCode() == kEndOfInput) {
+                break;
+            }
+            uint64_t parsed_at = timed ? Metrics::Now() : 0;
+            parsed++;
+            if (record.IsOk()) {
+                record = ProcessSample(sample);
+            }
+            if (timed) {
+                uint64_t end = Metrics::Now();
+                parse_time += parsed_at - start;
+                train_time += end - parsed_at;
+                start = end;
+            }
+            if (!record.IsOk()) {
+                invalid++;
+                if (record.GetCode() == kDimensionMismatch) {
+                    std::ostringstream message;
+                    message << record.GetMessage() << " at byte " << reader.GetRecordOffset();
+                    record = Status(kDimensionMismatch, message.str());
+                }
+                if (policy == kStopOnBadRecord) {
+                    status = record;
+                    break;
+                }
+                skipped_records_++;
+                NAIVE_BAYES_LOG(kLogWarning, "Skipped sample: " << record.GetMessage());
+            }
+        }
+        if (timed) {
+            Metrics& metrics = Metrics::Global();
+            metrics.AddTime(kParsePhase, parse_time);
+            metrics.AddTime(kTrainPhase, train_time);
+            metrics.AddCount(kSamplesParsed, parsed);
+            metrics.AddCount(kSamplesTrained, parsed - invalid);
+            metrics.AddCount(kInvalidSamples, invalid);
+        }
+        return status;
+    }
+
+    void Model::BuildShard(SampleReader reader, RecordPolicy policy) {
+        shard_status_ = ProcessSamples(reader, policy);
+    }
+
+    Status Model::AddCounts(const Model& other) {
+        if (other.train_total_ == 0) {
+            return Status();
+        }
+        if (num_pixels_ < 0) {
+            num_pixels_ = other.num_pixels_;
+            num_shades_ = other.num_shades_;
+            pixel_class_count_.assign(other.pixel_class_count_.size(), 0);
+            selected_pixels_.clear();
+        }
+        if (other.num_pixels_ != num_pixels_ || other.num_shades_ != num_shades_) {
+            return Status(kDimensionMismatch, "Invalid sizes of images");
+        }
+        train_total_ += other.train_total_;
+        for (size_t c = 0; c < 10; c++) {
+            train_class_total_[c] += other.train_class_total_[c];
+            if (other.train_class_total_[c] != 0) {
+                class_dirty_[c] = true;
+            }
+        }
+        for (size_t i = 0; i < pixel_class_count_.size(); i++) {
+            pixel_class_count_[i] += other.pixel_class_count_[i];
+        }
+        model_dirty_ = true;
+        return Status();
+    }
+
+    bool Model::HasCounts() const {
+        return num_pixels_ < 0 || !pixel_class_count_.empty();
     }
 
-    double Model::Classify(string fileName, double digit_accuracy[10]) {
-        ifstream my_file;
-        my_file.open(fileName);
-        if (!my_file || !my_file.is_open()) {
-            cout << "File open error: " << fileName << std::endl;
+    Status Model::Merge(const Model& other) {
+        if (mapped_file_ || !HasCounts() || !other.HasCounts()) {
+            return Status(kInvalidModel, "Only models with training counts can be merged");
+        }
+        if (other.laplace_ != laplace_) {
+            return Status(kInvalidArgument, "Only models with the same smoothing can be merged");
+        }
+        return AddCounts(other);
+    }
+
+    Status Model::Subtract(const Model& other) {
+        if (mapped_file_ || !HasCounts() || !other.HasCounts()) {
+            return Status(kInvalidModel, "Only models with training counts can be subtracted");
+        }
+        if (other.laplace_ != laplace_) {
+            return Status(kInvalidArgument, "Only models with the same smoothing can be subtracted");
+        }
+        if (other.train_total_ == 0) {
+            return Status();
+        }
+        if (other.num_pixels_ != num_pixels_ || other.num_shades_ != num_shades_) {
+            return Status(kDimensionMismatch, "Invalid sizes of images");
+        }
+        // Check everything first so that a failed subtraction leaves the model as it was
+        for (size_t c = 0; c < 10; c++) {
+            if (other.train_class_total_[c] > train_class_total_[c]) {
+                return Status(kInvalidArgument, "Cannot subtract samples that were not counted into the model");
+            }
+        }
+        for (size_t i = 0; i < pixel_class_count_.size(); i++) {
+            if (other.pixel_class_count_[i] > pixel_class_count_[i]) {
+                return Status(kInvalidArgument, "Cannot subtract samples that were not counted into the model");
+            }
+        }
+        train_total_ -= other.train_total_;
+        for (size_t c = 0; c < 10; c++) {
+            train_class_total_[c] -= other.train_class_total_[c];
+            if (other.train_class_total_[c] != 0) {
+                class_dirty_[c] = true;
+            }
+        }
+        for (size_t i = 0; i < pixel_class_count_.size(); i++) {
+            pixel_class_count_[i] -= other.pixel_class_count_[i];
+        }
+        model_dirty_ = true;
+        return Status();
+    }
+
+    double Model::Classify(string fileName, double digit_accuracy[10], size_t num_threads) {
+        SampleReader reader;
+        Status status = OpenSamples(fileName, reader);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(kLogError, status.GetMessage());
             return -1;
         }
-        cout << "Classifying sample from file: " << fileName << endl;
+        NAIVE_BAYES_LOG(kLogInfo, "Classifying sample from file: " << fileName);
+        // Workers only read the model, so pending training is applied up front
+        Refresh();
+
+        // Every worker reads its own part of the file and counts into its own row,
+        // rows are merged once all threads are done
+        vector<SampleReader> parts = SplitSamples(fileName, reader, std::max<size_t>(num_threads, 1));
+        num_threads = parts.size();
+        vector<vector<size_t>> passed_thread(num_threads, vector<size_t>(10, 0));
+        vector<vector<size_t>> total_thread(num_threads, vector<size_t>(10, 0));
+        vector<std::thread> workers;
+        for (size_t t = 1; t < num_threads; t++) {
+            workers.push_back(std::thread(&Model::ClassifyRange, this, parts[t],
+                                          passed_thread[t].data(), total_thread[t].data()));
+        }
+        ClassifyRange(parts[0], passed_thread[0].data(), total_thread[0].data());
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
 
         size_t passed = 0;
         size_t total = 0;
         size_t passed_digit[10] = {0};
         size_t total_digit[10] = {0};
-
-        while (!my_file.eof()) {
-            Sample sample;
-            my_file >> sample;
-            if (sample.GetSampleLength() == sample.kSampleIgnore) {
-                break;
-            }
-            total++;
-            total_digit[sample.GetDigit()]++;
-            int classified_digit = CalculateClassification(sample);
-            if (sample.GetDigit() == classified_digit) {
-                passed++;
-                passed_digit[classified_digit]++;
+        for (size_t t = 0; t < num_threads; t++) {
+            for (int i = 0; i < kDigits; i++) {
+                passed_digit[i] += passed_thread[t][i];
+                total_digit[i] += total_thread[t][i];
+                passed += passed_thread[t][i];
+                total += total_thread[t][i];
             }
         }
         double accuracy = passed * 1.0 / total;
-        cout << "Accuracy of classification: " << accuracy << endl;
-        for (size_t i = 0; i < kDigits; i++) {
+        NAIVE_BAYES_LOG(kLogInfo, "Accuracy of classification: " << accuracy);
+        for (int i = 0; i < kDigits; i++) {
             digit_accuracy[i] = passed_digit[i] * 1.0 / total_digit[i];
-            cout << "Accuracy of " << i << ": " << digit_accuracy[i] << endl;
+            NAIVE_BAYES_LOG(kLogInfo, "Accuracy of " << i << ": " << digit_accuracy[i]);
         }
-        my_file.close();
         return accuracy;
     }
 
+    void Model::ClassifyRange(SampleReader reader, size_t passed_digit[10], size_t total_digit[10]) const {
+        bool timed = Metrics::IsEnabled();
+        uint64_t parse_time = 0;
+        uint64_t score_time = 0;
+        size_t parsed = 0;
+        size_t invalid = 0;
+        Sample sample;
+        uint64_t start = timed ? Metrics::Now() : 0;
+        while (reader.Next(sample)) {
+            parsed++;
+            int digit = sample.GetDigit();
+            if (digit < 0 || digit > 9) {
+                invalid++;
+                continue;
+            }
+            invalid += sample.GetSampleLength() < 0;
+            uint64_t parsed_at = timed ? Metrics::Now() : 0;
+            total_digit[digit]++;
+            if (ClassifySample(sample) == digit) {
+                passed_digit[digit]++;
+            }
+            if (timed) {
+                uint64_t end = Metrics::Now();
+                parse_time += parsed_at - start;
+                score_time += end - parsed_at;
+                start = end;
+            }
+        }
+        if (timed) {
+            Metrics& metrics = Metrics::Global();
+            metrics.AddTime(kParsePhase, parse_time);
+            metrics.AddTime(kScorePhase, score_time);
+            metrics.AddCount(kSamplesParsed, parsed);
+            metrics.AddCount(kSamplesClassified, parsed - invalid);
+            metrics.AddCount(kInvalidSamples, invalid);
+        }
+    }
+
     void Model::Print() {
         if (num_pixels_ < 0) {
             // Invalid model
             return;
         }
+        Refresh();
+        // The logger writes to the same stream from its own thread, its messages go first
+        Logger::Global().Flush();
         cout << "Total number of images: " << train_total_ << endl;
         for (int i = 0; i < 10; i++) {
             cout << "Class " << i << " prior: " << p_prior_[i] << endl;
         }
 
         for (int c = 0; c < 10; c++) {
-            for (int v = 0; v < kNumShades; v++) {
+            for (int v = 0; v < num_shades_; v++) {
                 cout << "c: " << c << " : " << v << endl;
                 for (int i = 0; i < num_pixels_; i++) {
                     for (int j = 0; j < num_pixels_; j++) {
-                        //printf("%05.3f ", p_likelihood_class_pixel_[c][v][i * num_pixels_ + j]);
-                        cout << p_likelihood_class_pixel_[c][v][i * num_pixels_ + j] << " ";
+                        //printf("%05.3f ", LikelihoodRow(c, v)[i * num_pixels_ + j]);
+                        cout << LikelihoodRow(c, v)[i * num_pixels_ + j] << " ";
                     }
                     cout << endl;
                 }
@@ -105,120 +373,604 @@ namespace naivebayes {
         }
     }
 
-    int Model::Save(string filename) {
-        if (num_pixels_ < 0) {
-            // Invalid model
-            cout << "Could not save. Model is not valid.";
+    int Model::Save(string filename, ModelFormat format) {
+        Status status = SaveFile(filename, format);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(kLogError, status.GetMessage());
             return 0;
         }
+        return 1;
+    }
+
+    int Model::Load(string filename) {
+        Status status = LoadFile(filename);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(kLogError, status.GetMessage());
+            return 0;
+        }
+        return 1;
+    }
+
+    int Model::Map(string filename) {
+        Status status = MapFile(filename);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(kLogError, status.GetMessage());
+            return 0;
+        }
+        return 1;
+    }
+
+    Status Model::SaveFile(const string& filename, ModelFormat format) {
+        if (num_pixels_ < 0) {
+            return Status(kInvalidModel, "Could not save. Model is not valid.");
+        }
+        Refresh();
+        PhaseTimer timer(kSavePhase);
+        if (format == kBinaryModel) {
+            return SaveBinary(filename);
+        }
         ofstream my_file(filename);
         if (!my_file.is_open()) {
-            cout << "Cannot open file for writing: " << filename << endl;
-            return 0; // error
+            return Status(kIoError, "Cannot open file for writing: " + filename);
+        }
+        // Two shade models with the default smoothing keep the original header of just the dimension
+        my_file << num_pixels_;
+        if (num_shades_ != 2 || !selected_pixels_.empty() || laplace_ != 1.0) {
+            my_file << " " << num_shades_;
+        }
+        if (!selected_pixels_.empty() || laplace_ != 1.0) {
+            my_file << " " << selected_pixels_.size();
+        }
+        if (laplace_ != 1.0) {
+            std::streamsize precision = my_file.precision(17);
+            my_file << " " << laplace_;
+            my_file.precision(precision);
+        }
+        my_file << endl;
+        if (!selected_pixels_.empty()) {
+            for (size_t i = 0; i < selected_pixels_.size(); i++) {
+                my_file << selected_pixels_[i] << " ";
+            }
+            my_file << endl;
         }
-        my_file << num_pixels_ << endl;
         for (size_t i = 0; i < 10; i++) {
             my_file << p_prior_[i] << endl;
         }
 
         for (int c = 0; c < 10; c++) {
-            for (int v = 0; v < kNumShades; v++) {
+            for (int v = 0; v < num_shades_; v++) {
                 my_file << c << " " << v << endl;
                 for (int i = 0; i < num_pixels_; i++) {
                     for (int j = 0; j < num_pixels_; j++) {
-                        my_file << p_likelihood_class_pixel_[c][v][i * num_pixels_ + j] << " ";
+                        my_file << LikelihoodRow(c, v)[i * num_pixels_ + j] << " ";
                     }
                     my_file << endl;
                 }
             }
         }
         my_file.close();
-        cout << "Saved model to file: " << filename << endl;
-        return 1; // success
+        NAIVE_BAYES_LOG(kLogInfo, "Saved model to file: " << filename);
+        return Status();
     }
 
-    int Model::Load(string filename) {
+    Status Model::LoadFile(const string& filename) {
+        PhaseTimer timer(kLoadPhase);
         num_pixels_ = -1; // Invalidate model before loading a new one into it
-        ifstream my_file(filename);
+        Unmap();
+        ClearCounts();
+        selected_pixels_.clear();
+        laplace_ = 1.0;
+        ifstream my_file(filename, std::ios::binary);
         if (!my_file.is_open()) {
-            cout << "Cannot open file for reading: " << filename << endl;
-            return 0; // error
+            return Status(kIoError, "Cannot open file for reading: " + filename);
+        }
+        char magic[sizeof(kModelFileMagic)];
+        if (my_file.read(magic, sizeof(magic)) && std::equal(magic, magic + sizeof(magic), kModelFileMagic)) {
+            return LoadBinary(my_file, filename);
+        }
+        my_file.clear();
+        my_file.seekg(0);
+        string header;
+        getline(my_file, header);
+        std::istringstream header_fields(header);
+        int num_shades = 2;
+        size_t num_selected = 0;
+        double laplace = 1.0;
+        header_fields >> num_pixels_;
+        if (!(header_fields >> num_shades)) {
+            num_shades = 2;
+        }
+        header_fields >> num_selected;
+        if (!(header_fields >> laplace)) {
+            laplace = 1.0;
+        }
+        if (num_shades < 2 || num_shades > Sample::kMaxShades || num_pixels_ < 0 ||
+            num_selected > (size_t) num_pixels_ * num_pixels_ || !(laplace > 0)) {
+            num_pixels_ = -1;
+            return Status(kFormatError, "Unsupported model file: " + filename);
+        }
+        num_shades_ = num_shades;
+        laplace_ = laplace;
+        selected_pixels_.resize(num_selected);
+        // Selected pixels index the tables, so they are checked like those of a binary model
+        size_t pixel_count = (size_t) num_pixels_ * num_pixels_;
+        for (size_t i = 0; i < num_selected; i++) {
+            if (!(my_file >> selected_pixels_[i]) || selected_pixels_[i] >= pixel_count ||
+                (i > 0 && selected_pixels_[i] <= selected_pixels_[i - 1])) {
+                num_pixels_ = -1;
+                selected_pixels_.clear();
+                return Status(kFormatError, "Model file is corrupt: " + filename);
+            }
         }
-        my_file >> num_pixels_;
         for (int i = 0; i < 10; i++) {
             my_file >> p_prior_[i];
         }
 
         int c_file;
         int v_file;
+        p_likelihood_.resize(TableIndex(kDigits, 0, 0));
         for (int c = 0; c < 10; c++) {
-            for (int v = 0; v < kNumShades; v++) {
-                p_likelihood_class_pixel_[c][v].resize(num_pixels_ * num_pixels_);
+            for (int v = 0; v < num_shades_; v++) {
                 my_file >> c_file >> v_file;
                 for (int i = 0; i < num_pixels_; i++) {
                     for (int j = 0; j < num_pixels_; j++) {
-                        my_file >> p_likelihood_class_pixel_[c][v][i * num_pixels_ + j];
+                        my_file >> p_likelihood_[TableIndex(c, v, i * num_pixels_ + j)];
                     }
                 }
             }
         }
         my_file.close();
-        cout << "Loaded model from file: " << filename << endl;
-        return 1;
+        scorer_.Build(p_prior_, p_likelihood_.data(), num_pixels_, num_shades_);
+        SyncScoringTables();
+        NAIVE_BAYES_LOG(kLogInfo, "Loaded model from file: " << filename);
+        return Status();
     }
 
-    void Model::ProcessSample(Sample& sample) {
-        if (sample.GetSampleLength() == sample.kSampleError || sample.GetSampleLength() == sample.kSampleIgnore) {
-            // Sample is invalid. Do not process.
-            return;
+    Status Model::SaveBinary(const string& filename) {
+        ofstream my_file(filename, std::ios::binary);
+        if (!my_file.is_open()) {
+            return Status(kIoError, "Cannot open file for writing: " + filename);
         }
-        if (num_pixels_ < 0) {
-            // set up dimensions after reading first sample
-            num_pixels_ = sample.GetSampleLength();
-            //cout << "num pixels set to: " << num_pixels_ << endl;
-            for (size_t c = 0; c < 10; c++) {
-                for (size_t v = 0; v < kNumShades; v++) {
-                    pixel_class_count_[c][v].resize(num_pixels_ * num_pixels_);
+        size_t pixel_count = num_pixels_ * num_pixels_;
+        // Models that still have their counts save them too, so the file can be merged later
+        bool with_counts = !pixel_class_count_.empty();
+        size_t num_selected = selected_pixels_.size();
+        ModelFileLayout layout = GetModelFileLayout(num_pixels_, num_shades_, kDigits, Scorer::kClassStride,
+                                                    with_counts, num_selected);
+        vector<char> buffer(layout.size, 0);
+        memcpy(&buffer[layout.prior], p_prior_, kDigits * sizeof(double));
+        memcpy(&buffer[layout.blank_scores], scorer_.GetBlankScores(), Scorer::kClassStride * sizeof(double));
+        if (num_selected == 0) {
+            memcpy(&buffer[layout.likelihood], LikelihoodRow(0, 0), TableIndex(kDigits, 0, 0) * sizeof(double));
+            memcpy(&buffer[layout.deltas], scorer_.GetDeltas(),
+                   (num_shades_ - 1) * pixel_count * Scorer::kClassStride * sizeof(double));
+        } else {
+            // Only the selected pixels, in the order of selected_pixels_
+            double* likelihood = reinterpret_cast<double*>(&buffer[layout.likelihood]);
+            double* deltas = reinterpret_cast<double*>(&buffer[layout.deltas]);
+            for (int c = 0; c < kDigits; c++) {
+                for (int v = 0; v < num_shades_; v++) {
+                    for (size_t i = 0; i < num_selected; i++) {
+                        *likelihood++ = LikelihoodRow(c, v)[selected_pixels_[i]];
+                    }
                 }
             }
+            for (int v = 1; v < num_shades_; v++) {
+                for (size_t i = 0; i < num_selected; i++) {
+                    size_t row = (v - 1) * pixel_count + selected_pixels_[i];
+                    memcpy(deltas, scorer_.GetDeltas() + row * Scorer::kClassStride,
+                           Scorer::kClassStride * sizeof(double));
+                    deltas += Scorer::kClassStride;
+                }
+            }
+            memcpy(&buffer[layout.selected_pixels], selected_pixels_.data(), num_selected * sizeof(uint32_t));
         }
-        if (sample.GetSampleLength() != num_pixels_) {
-            cout << "Invalid sizes of images \n";
-            num_pixels_ = -1;
-            return;
+        if (with_counts) {
+            int32_t* totals = reinterpret_cast<int32_t*>(&buffer[layout.class_totals]);
+            int32_t* counts = reinterpret_cast<int32_t*>(&buffer[layout.pixel_counts]);
+            for (int c = 0; c < kDigits; c++) {
+                totals[c] = train_class_total_[c];
+            }
+            for (size_t i = 0; i < pixel_class_count_.size(); i++) {
+                counts[i] = pixel_class_count_[i];
+            }
+        }
+
+        ModelFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kModelFileMagic, sizeof(header.magic));
+        header.version = kModelFileVersion;
+        header.num_pixels = num_pixels_;
+        header.num_shades = num_shades_;
+        header.num_classes = kDigits;
+        header.class_stride = Scorer::kClassStride;
+        header.flags = (with_counts ? kModelFileHasCounts : 0) | (num_selected > 0 ? kModelFileHasSelection : 0);
+        header.num_selected = num_selected;
+        header.laplace = laplace_;
+        header.payload_size = layout.size - sizeof(header);
+        header.checksum = ModelFileChecksum(&buffer[sizeof(header)], header.payload_size);
+        memcpy(&buffer[0], &header, sizeof(header));
+
+        if (!my_file.write(buffer.data(), buffer.size())) {
+            return Status(kIoError, "Cannot write to file: " + filename);
+        }
+        my_file.close();
+        NAIVE_BAYES_LOG(kLogInfo, "Saved model to file: " << filename);
+        return Status();
+    }
+
+    Status Model::LoadBinary(ifstream& my_file, const string& filename) {
+        // The whole file is brought in with a single read
+        my_file.seekg(0, std::ios::end);
+        size_t size = my_file.tellg();
+        my_file.seekg(0);
+        vector<char> buffer(size);
+        ModelFileHeader header;
+        if (!my_file.read(buffer.data(), size)) {
+            return Status(kIoError, "Cannot read file: " + filename);
+        }
+        ModelFileLayout layout;
+        Status status = ReadBinaryHeader(buffer.data(), size, filename, true, header, layout);
+        if (!status.IsOk()) {
+            return status;
+        }
+
+        num_pixels_ = header.num_pixels;
+        num_shades_ = header.num_shades;
+        laplace_ = header.laplace > 0 ? header.laplace : 1.0;
+        memcpy(p_prior_, &buffer[layout.prior], kDigits * sizeof(double));
+        const double* likelihood = reinterpret_cast<const double*>(&buffer[layout.likelihood]);
+        const double* blank_scores = reinterpret_cast<const double*>(&buffer[layout.blank_scores]);
+        const double* deltas = reinterpret_cast<const double*>(&buffer[layout.deltas]);
+        if (header.flags & kModelFileHasSelection) {
+            if (!ExpandSelection(&buffer[layout.selected_pixels], header.num_selected, likelihood, blank_scores,
+                                 deltas)) {
+                num_pixels_ = -1;
+                return Status(kFormatError, "Model file is corrupt: " + filename);
+            }
+        } else {
+            p_likelihood_.assign(likelihood, likelihood + TableIndex(kDigits, 0, 0));
+            scorer_.Assign(num_pixels_, num_shades_, blank_scores, deltas);
+        }
+        SyncScoringTables();
+        if (header.flags & kModelFileHasCounts) {
+            const int32_t* totals = reinterpret_cast<const int32_t*>(&buffer[layout.class_totals]);
+            const int32_t* counts = reinterpret_cast<const int32_t*>(&buffer[layout.pixel_counts]);
+            for (int c = 0; c < kDigits; c++) {
+                train_class_total_[c] = totals[c];
+                train_total_ += totals[c];
+            }
+            pixel_class_count_.assign(counts, counts + TableIndex(kDigits, 0, 0));
+        }
+        NAIVE_BAYES_LOG(kLogInfo, "Loaded model from file: " << filename);
+        return Status();
+    }
+
+    bool Model::ExpandSelection(const char* indices, size_t num_selected, const double* likelihood,
+                                const double* blank_scores, const double* deltas) {
+        size_t pixel_count = num_pixels_ * num_pixels_;
+        selected_pixels_.resize(num_selected);
+        memcpy(selected_pixels_.data(), indices, num_selected * sizeof(uint32_t));
+        for (size_t i = 0; i < num_selected; i++) {
+            if (selected_pixels_[i] >= pixel_count || (i > 0 && selected_pixels_[i] <= selected_pixels_[i - 1])) {
+                selected_pixels_.clear();
+                return false;
+            }
+        }
+        // Pixels that were left out are uninformative: every shade is equally likely and has no delta
+        p_likelihood_.assign(TableIndex(kDigits, 0, 0), 1.0 / num_shades_);
+        for (int c = 0; c < kDigits; c++) {
+            for (int v = 0; v < num_shades_; v++) {
+                for (size_t i = 0; i < num_selected; i++) {
+                    p_likelihood_[TableIndex(c, v, selected_pixels_[i])] = *likelihood++;
+                }
+            }
+        }
+        AlignedVector<double> expanded((num_shades_ - 1) * pixel_count * Scorer::kClassStride, 0.0);
+        for (int v = 1; v < num_shades_; v++) {
+            for (size_t i = 0; i < num_selected; i++) {
+                size_t row = (v - 1) * pixel_count + selected_pixels_[i];
+                std::copy(deltas, deltas + Scorer::kClassStride, &expanded[row * Scorer::kClassStride]);
+                deltas += Scorer::kClassStride;
+            }
+        }
+        scorer_.Assign(num_pixels_, num_shades_, blank_scores, expanded.data());
+        return true;
+    }
+
+    Status Model::MapFile(const string& filename) {
+        num_pixels_ = -1; // Invalidate model before mapping a new one into it
+        Unmap();
+        ClearCounts();
+        selected_pixels_.clear();
+        laplace_ = 1.0;
+        std::shared_ptr<MappedFile> file(new MappedFile());
+        if (!file->Open(filename)) {
+            return Status(kIoError, "Cannot open file for reading: " + filename);
+        }
+        ModelFileHeader header;
+        ModelFileLayout layout;
+        // The checksum is not verified so that mapping never touches the tables
+        Status status = ReadBinaryHeader(file->GetData(), file->GetSize(), filename, false, header, layout);
+        if (!status.IsOk()) {
+            return status;
+        }
+        if (header.flags & kModelFileHasSelection) {
+            // The compact tables have to be expanded before they can be scored
+            return LoadFile(filename);
+        }
+        PhaseTimer timer(kLoadPhase);
+        const char* data = file->GetData();
+        num_shades_ = header.num_shades;
+        laplace_ = header.laplace > 0 ? header.laplace : 1.0;
+        memcpy(p_prior_, data + layout.prior, kDigits * sizeof(double));
+        mapped_likelihood_ = reinterpret_cast<const double*>(data + layout.likelihood);
+        scorer_.View(header.num_pixels, header.num_shades, reinterpret_cast<const double*>(data + layout.blank_scores),
+                     reinterpret_cast<const double*>(data + layout.deltas));
+        p_likelihood_.clear();
+        mapped_file_ = file;
+        num_pixels_ = header.num_pixels;
+        SyncScoringTables();
+        NAIVE_BAYES_LOG(kLogInfo, "Mapped model from file: " << filename);
+        return Status();
+    }
+
+    Status Model::ReadBinaryHeader(const char* data, size_t size, const string& filename, bool verify_checksum,
+                                   ModelFileHeader& header, ModelFileLayout& layout) const {
+        if (size < sizeof(header) || !std::equal(data, data + sizeof(kModelFileMagic), kModelFileMagic)) {
+            return Status(kFormatError, "Not a binary model file: " + filename);
+        }
+        memcpy(&header, data, sizeof(header));
+        if (header.version != kModelFileVersion || header.num_shades < 2 ||
+            header.num_shades > (uint32_t) Sample::kMaxShades ||
+            header.num_classes != (uint32_t) kDigits || header.class_stride != (uint32_t) Scorer::kClassStride ||
+            (header.flags & ~(kModelFileHasCounts | kModelFileHasSelection)) != 0 ||
+            ((header.flags & kModelFileHasSelection) != 0) != (header.num_selected > 0) ||
+            header.num_selected > (uint64_t) header.num_pixels * header.num_pixels || !(header.laplace >= 0)) {
+            return Status(kFormatError, "Unsupported model file: " + filename);
+        }
+        layout = GetModelFileLayout(header.num_pixels, header.num_shades, kDigits, Scorer::kClassStride,
+                                    (header.flags & kModelFileHasCounts) != 0, header.num_selected);
+        if (layout.size != size || header.payload_size != size - sizeof(header) ||
+            (verify_checksum && header.checksum != ModelFileChecksum(data + sizeof(header), header.payload_size))) {
+            return Status(kFormatError, "Model file is corrupt: " + filename);
+        }
+        return Status();
+    }
+
+    void Model::Unmap() {
+        if (mapped_file_) {
+            // The scorer may still be reading from the mapping
+            scorer_ = Scorer();
+        }
+        mapped_likelihood_ = nullptr;
+        mapped_file_.reset();
+        fixed_model_.reset();
+    }
+
+    const double* Model::LikelihoodRow(int digit, int value) const {
+        const double* table = mapped_likelihood_ != nullptr ? mapped_likelihood_ : p_likelihood_.data();
+        return table + TableIndex(digit, value, 0);
+    }
+
+    size_t Model::TableIndex(int digit, int value, size_t pixel) const {
+        return ((size_t) digit * num_shades_ + value) * num_pixels_ * num_pixels_ + pixel;
+    }
+
+    Status Model::ProcessSample(const Sample& sample) {
+        if (!HasCounts()) {
+            return Status(kInvalidModel, "Model has no training counts to add to");
+        }
+        if (sample.GetSampleLength() < 0) {
+            return Status(kFormatError, "Sample is malformed");
+        }
+        if (sample.GetDigit() < 0 || sample.GetDigit() > 9) {
+            return Status(kFormatError, "Incorrect digit: " + std::to_string(sample.GetDigit()));
+        }
+        if (sample.GetNumShades() != num_shades_ || (num_pixels_ >= 0 && sample.GetSampleLength() != num_pixels_)) {
+            return Status(kDimensionMismatch, "Invalid sizes of images");
+        }
+        if (num_pixels_ < 0) {
+            // set up dimensions after reading first sample
+            StartCounts(sample.GetSampleLength());
         }
         train_total_++;
         train_class_total_[sample.GetDigit()]++;
-        for (size_t i = 0; i < sample.GetImagePixels().size(); i++) {
-            int val = sample.GetImagePixels()[i];
-            if (sample.GetDigit() < 0 || sample.GetDigit() > 9) {
-                cout << "incorrect digit: " << sample.GetDigit() << endl;
-                num_pixels_ = -1; // Invalidate sample
-                return;
+        class_dirty_[sample.GetDigit()] = true;
+        model_dirty_ = true;
+        // Shade v of pixel i is counted at counts[v * pixel_count + i]. Every pixel is
+        // counted as shade 0 first; bit b of the sample is shade b / pixel_count + 1 of
+        // pixel b % pixel_count, which moves that pixel to the shade's count.
+        const vector<uint64_t>& words = sample.GetPackedPixels();
+        size_t pixel_count = num_pixels_ * num_pixels_;
+        int* counts = &pixel_class_count_[TableIndex(sample.GetDigit(), 0, 0)];
+        for (size_t i = 0; i < pixel_count; i++) {
+            counts[i]++;
+        }
+        for (size_t w = 0; w < words.size(); w++) {
+            for (uint64_t bits = words[w]; bits != 0; bits &= bits - 1) {
+                size_t bit = w * Sample::kWordBits + CountTrailingZeros(bits);
+                counts[pixel_count + bit]++;
+                counts[bit % pixel_count]--;
             }
-
-            pixel_class_count_[sample.GetDigit()][val][i]++;
         }
+        return Status();
     }
 
     void Model::BuildPrior() {
         for (size_t i = 0; i < 10; i++) {
-            p_prior_[i] = (kLaplace + train_class_total_[i]) / (10.0 * kLaplace + train_total_);
+            p_prior_[i] = (laplace_ + train_class_total_[i]) / (10.0 * laplace_ + train_total_);
         }
     }
 
     void Model::BuildLikelihood() {
-        for (size_t c = 0; c < 10; c++) {
-            for (size_t v = 0; v < kNumShades; v++) {
-                p_likelihood_class_pixel_[c][v].resize(num_pixels_ * num_pixels_);
-                for (size_t i = 0; i < num_pixels_; i++) {
-                    for (size_t j = 0; j < num_pixels_; j++) {
-                        p_likelihood_class_pixel_[c][v][i * num_pixels_ + j] = (kLaplace + pixel_class_count_[c][v][i * num_pixels_ + j])
-                                / (2 * kLaplace + train_class_total_[c]);
-                    }
+        PhaseTimer timer(kBuildTablesPhase);
+        Unmap();
+        if (num_pixels_ < 0) {
+            scorer_ = Scorer();
+            SyncScoringTables();
+            return;
+        }
+        p_likelihood_.resize(pixel_class_count_.size());
+        for (int c = 0; c < kDigits; c++) {
+            BuildClassLikelihood(c);
+            class_dirty_[c] = false;
+        }
+        scorer_.Build(p_prior_, p_likelihood_.data(), num_pixels_, num_shades_);
+        SyncScoringTables();
+        model_dirty_ = false;
+    }
+
+    void Model::BuildClassLikelihood(int digit) {
+        double denominator = num_shades_ * laplace_ + train_class_total_[digit];
+        size_t end = TableIndex(digit + 1, 0, 0);
+        for (size_t i = TableIndex(digit, 0, 0); i < end; i++) {
+            p_likelihood_[i] = (laplace_ + pixel_class_count_[i]) / denominator;
+        }
+        if (selected_pixels_.empty()) {
+            return;
+        }
+        // Pixels that were not selected are uninformative: every shade is equally likely
+        size_t next = 0;
+        for (size_t p = 0; p < (size_t) num_pixels_ * num_pixels_; p++) {
+            if (next < selected_pixels_.size() && selected_pixels_[next] == p) {
+                next++;
+                continue;
+            }
+            for (int v = 0; v < num_shades_; v++) {
+                p_likelihood_[TableIndex(digit, v, p)] = 1.0 / num_shades_;
+            }
+        }
+    }
+
+    double Model::PixelInformation(size_t pixel) const {
+        // I(shade; label) = sum over shades v and digits c of P(v, c) log(P(v, c) / (P(v) P(c)))
+        double total = train_total_;
+        double information = 0;
+        for (int v = 0; v < num_shades_; v++) {
+            double shade_total = 0;
+            for (int c = 0; c < kDigits; c++) {
+                shade_total += pixel_class_count_[TableIndex(c, v, pixel)];
+            }
+            for (int c = 0; c < kDigits; c++) {
+                double count = pixel_class_count_[TableIndex(c, v, pixel)];
+                if (count > 0) {
+                    information += count / total * std::log(count * total / (shade_total * train_class_total_[c]));
                 }
             }
         }
+        return information;
+    }
+
+    Status Model::SelectPixels(size_t num_kept) {
+        if (num_pixels_ < 0 || pixel_class_count_.empty() || train_total_ == 0) {
+            return Status(kInvalidModel, "Pixels can only be selected in a model with training counts");
+        }
+        if (num_kept == 0) {
+            return Status(kInvalidArgument, "At least one pixel has to be kept");
+        }
+        size_t pixel_count = num_pixels_ * num_pixels_;
+        selected_pixels_.clear();
+        if (num_kept < pixel_count) {
+            vector<double> information(pixel_count);
+            vector<uint32_t> order(pixel_count);
+            for (size_t p = 0; p < pixel_count; p++) {
+                information[p] = PixelInformation(p);
+                order[p] = p;
+            }
+            // Ties keep the lower pixel index, so the selection is deterministic
+            std::stable_sort(order.begin(), order.end(), [&information](uint32_t a, uint32_t b) {
+                return information[a] > information[b];
+            });
+            order.resize(num_kept);
+            std::sort(order.begin(), order.end());
+            selected_pixels_ = order;
+        }
+        BuildPrior();
+        BuildLikelihood();
+        return Status();
+    }
+
+    Status Model::SetLaplace(double laplace) {
+        if (!(laplace > 0)) {
+            return Status(kInvalidArgument, "Smoothing needs a positive count");
+        }
+        if (mapped_file_ || !HasCounts()) {
+            return Status(kInvalidModel, "Smoothing needs a model with training counts");
+        }
+        laplace_ = laplace;
+        for (int c = 0; c < kDigits; c++) {
+            class_dirty_[c] = true;
+        }
+        model_dirty_ = true;
+        return Status();
+    }
+
+    double Model::GetLaplace() const {
+        return laplace_;
+    }
+
+    const vector<uint32_t>& Model::GetSelectedPixels() const {
+        return selected_pixels_;
+    }
+
+    void Model::Refresh() {
+        if (!model_dirty_ || num_pixels_ < 0) {
+            return;
+        }
+        BuildPrior();
+        if (p_likelihood_.size() != pixel_class_count_.size() || scorer_.GetSampleLength() != num_pixels_) {
+            // Nothing was derived from the counts yet
+            BuildLikelihood();
+            return;
+        }
+        PhaseTimer timer(kBuildTablesPhase);
+        bool updated[10];
+        for (int c = 0; c < kDigits; c++) {
+            updated[c] = class_dirty_[c];
+            if (class_dirty_[c]) {
+                BuildClassLikelihood(c);
+                scorer_.UpdateClass(c, &p_likelihood_[TableIndex(c, 0, 0)]);
+                class_dirty_[c] = false;
+            }
+        }
+        scorer_.SetPriors(p_prior_);
+        UpdateFixedModel(updated);
+        model_dirty_ = false;
+    }
+
+    Status Model::Train(const Sample& sample) {
+        Status status = ProcessSample(sample);
+        if (Metrics::IsEnabled() && status.GetCode() != kInvalidModel) {
+            Metrics::Global().AddCount(status.IsOk() ? kSamplesTrained : kInvalidSamples);
+        }
+        return status;
+    }
+
+    Result<size_t> Model::Train(const vector<Sample>& samples) {
+        if (!HasCounts()) {
+            return Status(kInvalidModel, "Model has no training counts to add to");
+        }
+        size_t trained = 0;
+        for (size_t i = 0; i < samples.size(); i++) {
+            Status status = Train(samples[i]);
+            if (status.IsOk()) {
+                trained++;
+            } else {
+                NAIVE_BAYES_LOG(kLogWarning, "Skipped sample " << i << ": " << status.GetMessage());
+            }
+        }
+        return trained;
+    }
+
+    void Model::ClearCounts() {
+        train_total_ = 0;
+        for (size_t i = 0; i < 10; i++) {
+            train_class_total_[i] = 0;
+            class_dirty_[i] = false;
+        }
+        pixel_class_count_.clear();
+        model_dirty_ = false;
     }
 
     int Model::GetSampleTotals() {
@@ -228,17 +980,19 @@ namespace naivebayes {
     double Model::GetLikelihood(int digit, int value, int row, int column) {
         if (row < 0 || row >= num_pixels_ ||
             column < 0 || column >= num_pixels_ ||
-            value < 0 || value >= kNumShades ||
+            value < 0 || value >= num_shades_ ||
             digit < 0 || digit > 9 || num_pixels_ < 0) {
             return -1.0;
         }
-        return p_likelihood_class_pixel_[digit][value][row * num_pixels_ + column];
+        Refresh();
+        return LikelihoodRow(digit, value)[row * num_pixels_ + column];
     }
 
     double Model::GetPrior(int digit) {
         if (digit < 0 || digit > 9 || num_pixels_ < 0) {
             return -1;
         }
+        Refresh();
         return p_prior_[digit];
     }
 
@@ -246,31 +1000,116 @@ namespace naivebayes {
         return num_pixels_;
     }
 
+    int Model::GetNumShades() {
+        return num_shades_;
+    }
+
     int Model::CalculateClassification(Sample &sample) {
-        if (sample.GetSampleLength() != num_pixels_) {
-            cout << "Invalid sample dimensions." << endl;
+        Result<int> digit = Predict(sample);
+        if (!digit.IsOk()) {
+            NAIVE_BAYES_LOG(kLogWarning, digit.GetStatus().GetMessage());
             return -1;
         }
-        // Computing
-        double p_bayes[10];
-        for (int i = 0; i < kDigits; i++) {
-            p_bayes[i] = p_prior_[i];
-            for (int r = 0; r < num_pixels_; r++) {
-                for (int c = 0; c < num_pixels_; c++) {
-                    int v = sample.GetImagePixels()[r * num_pixels_ + c];
-                    p_bayes[i] *= p_likelihood_class_pixel_[i][v][r * num_pixels_ + c];
-                }
+        return digit.GetValue();
+    }
+
+    Result<int> Model::Predict(const Sample& sample) {
+        if (num_pixels_ < 0 || sample.GetSampleLength() != num_pixels_ || sample.GetNumShades() != num_shades_) {
+            if (Metrics::IsEnabled()) {
+                Metrics::Global().AddCount(kInvalidSamples);
             }
+            return Status(num_pixels_ < 0 ? kInvalidModel : kDimensionMismatch, "Invalid sample dimensions.");
         }
+        Refresh();
+        if (!Metrics::IsEnabled()) {
+            return ClassifySample(sample);
+        }
+        uint64_t start = Metrics::Now();
+        int digit = ClassifySample(sample);
+        uint64_t elapsed = Metrics::Now() - start;
+        Metrics& metrics = Metrics::Global();
+        metrics.AddTime(kScorePhase, elapsed);
+        metrics.AddCount(kSamplesClassified);
+        metrics.RecordLatency(elapsed);
+        return digit;
+    }
 
-        // Comparing
-        int bayes_digit = p_bayes[0];
-        for (int j = 0; j < kDigits; j++) {
-            if (p_bayes[j] > p_bayes[bayes_digit]) {
-                bayes_digit = j;
+    Result<int> Model::CalculatePosteriors(const Sample& sample, double log_posteriors[10], int top[], size_t k) {
+        if (k > 0 && top == nullptr) {
+            return Status(kInvalidArgument, "Top digits asked for without an array to write them to");
+        }
+        if (num_pixels_ < 0 || sample.GetSampleLength() != num_pixels_ || sample.GetNumShades() != num_shades_) {
+            if (Metrics::IsEnabled()) {
+                Metrics::Global().AddCount(kInvalidSamples);
             }
+            return Status(num_pixels_ < 0 ? kInvalidModel : kDimensionMismatch, "Invalid sample dimensions.");
+        }
+        Refresh();
+        double p_bayes[Scorer::kClassStride];
+        int best = ScoreSample(sample, p_bayes);
+        if (best < 0) {
+            return Status(kInvalidModel, "Model has no scoring tables");
+        }
+        // log of the sum of exp(score), shifted by the largest score so that exp() stays in range
+        double total = 0;
+        for (int c = 0; c < kDigits; c++) {
+            total += std::exp(p_bayes[c] - p_bayes[best]);
+        }
+        double log_evidence = p_bayes[best] + std::log(total);
+        for (int c = 0; c < kDigits; c++) {
+            log_posteriors[c] = p_bayes[c] - log_evidence;
+        }
+
+        int order[10];
+        for (int c = 0; c < kDigits; c++) {
+            order[c] = c;
+        }
+        k = std::min<size_t>(k, kDigits);
+        std::partial_sort(order, order + k, order + kDigits, [&p_bayes](int a, int b) {
+            return p_bayes[a] > p_bayes[b] || (p_bayes[a] == p_bayes[b] && a < b);
+        });
+        for (size_t i = 0; i < k; i++) {
+            top[i] = order[i];
+        }
+        return best;
+    }
+
+    int Model::ScoreSample(const Sample& sample, double scores[Scorer::kClassStride]) const {
+        if (fixed_model_ && sample.GetSampleLength() == fixed_model_->GetSampleLength() &&
+            sample.GetNumShades() == fixed_model_->GetNumShades()) {
+            return fixed_model_->Score(sample, scores);
+        }
+        return scorer_.Score(sample, scores);
+    }
+
+    int Model::ClassifySample(const Sample& sample) const {
+        double p_bayes[Scorer::kClassStride];
+        return ScoreSample(sample, p_bayes);
+    }
+
+    void Model::UpdateFixedModel(const bool classes[10]) {
+        if (!fixed_model_) {
+            return;
+        }
+        if (fixed_model_.use_count() > 1) {
+            fixed_model_ = fixed_model_->Clone();
+        }
+        for (int c = 0; c < kDigits; c++) {
+            if (classes[c]) {
+                fixed_model_->UpdateClass(c, scorer_.GetDeltas());
+            }
+        }
+        fixed_model_->SetBlankScores(scorer_.GetBlankScores());
+    }
+
+    void Model::SyncScoringTables() {
+        // A new copy, models copied from this one may still share the old one
+        fixed_model_.reset();
+        scorer_.Select(selected_pixels_);
+        if (num_pixels_ >= 0 && !mapped_file_ && scorer_.GetSampleLength() == num_pixels_) {
+            fixed_model_ = MakeFixedModel(num_pixels_, num_shades_, scorer_.GetBlankScores(), scorer_.GetDeltas(),
+                                          scorer_.GetRowMask());
         }
-        return bayes_digit;
     }
 }
 
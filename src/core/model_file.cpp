@@ -0,0 +1,37 @@
+#include "core/model_file.h"
+
+namespace naivebayes {
+    static_assert(sizeof(ModelFileHeader) == kModelFileAlignment, "Model file header must fill one aligned block");
+
+    namespace {
+        size_t Align(size_t offset) {
+            return (offset + kModelFileAlignment - 1) / kModelFileAlignment * kModelFileAlignment;
+        }
+    }
+
+    ModelFileLayout GetModelFileLayout(size_t num_pixels, size_t num_shades, size_t num_classes, size_t class_stride,
+                                       bool with_counts, size_t num_selected) {
+        size_t pixel_count = num_pixels * num_pixels;
+        size_t stored_count = num_selected > 0 ? num_selected : pixel_count;
+        ModelFileLayout layout;
+        layout.prior = sizeof(ModelFileHeader);
+        layout.likelihood = Align(layout.prior + num_classes * sizeof(double));
+        layout.blank_scores = Align(layout.likelihood + num_classes * num_shades * stored_count * sizeof(double));
+        layout.deltas = Align(layout.blank_scores + class_stride * sizeof(double));
+        layout.selected_pixels = Align(layout.deltas + (num_shades - 1) * stored_count * class_stride * sizeof(double));
+        layout.class_totals = Align(layout.selected_pixels + num_selected * sizeof(uint32_t));
+        layout.pixel_counts = Align(layout.class_totals + num_classes * sizeof(int32_t));
+        layout.size = with_counts ? Align(layout.pixel_counts + num_classes * num_shades * pixel_count * sizeof(int32_t))
+                                  : layout.class_totals;
+        return layout;
+    }
+
+    uint64_t ModelFileChecksum(const char* data, size_t size) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+}
@@ -4,21 +4,24 @@
 
 #include "core/sample.h"
 
+#include <algorithm>
+#include "core/logger.h"
+
 namespace naivebayes {
-    Sample::Sample(int numPixel): num_pixels_(numPixel) {
+    Sample::Sample(int numPixel, int numShades): num_pixels_(numPixel) {
         // digit will change after input is read
         digit_ = -1;
+        num_shades_ = numShades >= 2 && numShades <= kMaxShades ? numShades : 2;
         if (numPixel > 0) {
-            image_pixels_.resize(numPixel * numPixel);
-            std::fill(image_pixels_.begin(), image_pixels_.end(), 0);
+            Resize(numPixel);
         }
     }
 
-    Sample::Sample(string fileName) {
+    Sample::Sample(string fileName, int numShades): Sample(-1, numShades) {
         ifstream my_file;
         my_file.open(fileName);
         if (!my_file || !my_file.is_open()) {
-            cout << "File open error: " << fileName << std::endl;
+            NAIVE_BAYES_LOG(kLogError, "File open error: " << fileName);
             return;
         }
         my_file >> *this;
@@ -26,78 +29,164 @@ namespace naivebayes {
     }
 
     istream &operator>>(istream &input, Sample &sample) {
-        string line;
+        // One line buffer per thread, reading a sample does not allocate once it has grown
+        static thread_local string line;
+        sample.digit_ = -1;
+        sample.num_pixels_ = sample.kSampleError;
         if (!getline(input, line)) {
             // Last line of file, ignore sample
             sample.num_pixels_ = sample.kSampleIgnore;
             return input;
         }
         if (line.length() != 1) {
-            cout << "Training data format error, expected digit line length issue: " << line << endl;
+            NAIVE_BAYES_LOG(kLogWarning, "Training data format error, expected digit line length issue: " << line);
             return input;
         }
-        sample.digit_ = stoi(line);
-        if (sample.digit_ < 0 || sample.digit_ > 9) {
-            cout << "Training data format error, expected digit: " << line << endl;
+        if (line[0] < '0' || line[0] > '9') {
+            NAIVE_BAYES_LOG(kLogWarning, "Training data format error, expected digit: " << line);
             return input;
         }
+        sample.digit_ = line[0] - '0';
         int n = 0;
-        while (n < sample.num_pixels_ || sample.num_pixels_ < 0) {
+        while (n < sample.GetSampleLength() || sample.GetSampleLength() < 0) {
             if (!getline(input, line)) {
-                cout << "Training data format error: " << line << endl;
+                NAIVE_BAYES_LOG(kLogWarning, "Training data format error: " << line);
                 return input;
             }
             if (n == 0) {
-                sample.num_pixels_ = line.length();
-                sample.image_pixels_.resize(sample.num_pixels_ * sample.num_pixels_); // first lines length = image dimension
+                sample.Resize(line.length()); // first lines length = image dimension
             } else {
-                if (line.length() != sample.GetSampleLength()) {
-                    cout << "Lines are not the same length. Invalid";
+                if ((int) line.length() != sample.GetSampleLength()) {
+                    NAIVE_BAYES_LOG(kLogWarning, "Lines are not the same length. Invalid");
                     sample.num_pixels_ = sample.kSampleError;
                     return input;
                 }
             }
             // Process the line
-            for (size_t i = 0; i < line.length(); i++) {
-                int shade = 1;
-                if (line[i] == ' ') {
-                    shade = 0;
-                }
-                sample.image_pixels_[n * sample.num_pixels_ + i] = shade;
-            }
+            sample.DecodeRow(n, line.data());
             n++;
         }
         return input;
     }
 
-    int Sample::GetDigit() {
+    int Sample::GetDigit() const {
         return digit_;
     }
 
-    int Sample::GetSampleLength() {
+    int Sample::GetSampleLength() const {
         return num_pixels_;
     }
 
-    vector<int> &Sample::GetImagePixels() {
+    int Sample::GetNumShades() const {
+        return num_shades_;
+    }
+
+    const vector<uint64_t> &Sample::GetPackedPixels() const {
         return image_pixels_;
     }
 
+    int Sample::SetPackedPixels(const uint64_t* words, size_t num_words) {
+        if (num_words != image_pixels_.size() || num_words == 0) {
+            return -1;
+        }
+        std::copy(words, words + num_words, image_pixels_.begin());
+        // Keep the bits past the last plane clear
+        size_t used_bits = (num_shades_ - 1) * num_pixels_ * num_pixels_ % kWordBits;
+        if (used_bits != 0) {
+            image_pixels_.back() &= (uint64_t(1) << used_bits) - 1;
+        }
+        return 0;
+    }
+
+    void Sample::SetDigit(int digit) {
+        digit_ = digit;
+    }
+
     int Sample::GetPixel(size_t row, size_t col) const {
         if (row >= num_pixels_ || col >= num_pixels_) {
             return -1;
         }
-        return image_pixels_[row * num_pixels_ + col];
+        size_t pixel = row * num_pixels_ + col;
+        size_t pixel_count = num_pixels_ * num_pixels_;
+        for (size_t v = 1; v < num_shades_; v++) {
+            size_t bit = (v - 1) * pixel_count + pixel;
+            if ((image_pixels_[bit / kWordBits] >> (bit % kWordBits)) & 1) {
+                return v;
+            }
+        }
+        return 0;
     }
 
     int Sample::SetPixel(size_t row, size_t col, size_t shade) {
-        if (row >= num_pixels_ || col >= num_pixels_ || shade >= 2) {
+        if (row >= num_pixels_ || col >= num_pixels_ || shade >= num_shades_) {
             return -1;
         }
-        image_pixels_[row * num_pixels_ + col] = shade;
+        size_t pixel = row * num_pixels_ + col;
+        size_t pixel_count = num_pixels_ * num_pixels_;
+        for (size_t v = 1; v < num_shades_; v++) {
+            size_t bit = (v - 1) * pixel_count + pixel;
+            if (v == shade) {
+                image_pixels_[bit / kWordBits] |= uint64_t(1) << (bit % kWordBits);
+            } else {
+                image_pixels_[bit / kWordBits] &= ~(uint64_t(1) << (bit % kWordBits));
+            }
+        }
         return 0;
     }
 
     void Sample::Clear() {
         std::fill(image_pixels_.begin(), image_pixels_.end(), 0);
     }
+
+    int Sample::Reset(int numPixel, int numShades) {
+        if (numPixel <= 0 || numShades < 2 || numShades > kMaxShades) {
+            return -1;
+        }
+        digit_ = -1;
+        num_shades_ = numShades;
+        Resize(numPixel);
+        return 0;
+    }
+
+    void Sample::DecodeRow(size_t row, const char* line) {
+        if (num_pixels_ == 0) {
+            return;
+        }
+        if (num_shades_ > 2) {
+            // Every pixel sets at most one bit, in the plane of its shade
+            size_t pixel_count = num_pixels_ * num_pixels_;
+            for (size_t i = 0; i < num_pixels_; i++) {
+                size_t shade = Quantize(line[i]);
+                if (shade != 0) {
+                    size_t bit = (shade - 1) * pixel_count + row * num_pixels_ + i;
+                    image_pixels_[bit / kWordBits] |= uint64_t(1) << (bit % kWordBits);
+                }
+            }
+            return;
+        }
+        // Bits are gathered in a register and written once per word
+        size_t pixel = row * num_pixels_;
+        size_t index = pixel / kWordBits;
+        uint64_t word = image_pixels_[index];
+        for (size_t i = 0; i < num_pixels_; i++) {
+            word |= uint64_t(line[i] != ' ') << (pixel % kWordBits);
+            if (++pixel % kWordBits == 0) {
+                image_pixels_[index++] = word;
+                word = index < image_pixels_.size() ? image_pixels_[index] : 0;
+            }
+        }
+        if (pixel % kWordBits != 0) {
+            image_pixels_[index] = word;
+        }
+    }
+
+    size_t Sample::Quantize(char pixel) const {
+        size_t level = pixel == ' ' ? 0 : (pixel == '+' ? 1 : 2);
+        return (level * (num_shades_ - 1) + 1) / 2;
+    }
+
+    void Sample::Resize(size_t numPixel) {
+        num_pixels_ = numPixel;
+        image_pixels_.assign(((num_shades_ - 1) * numPixel * numPixel + kWordBits - 1) / kWordBits, 0);
+    }
 }
\ No newline at end of file
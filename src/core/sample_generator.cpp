@@ -0,0 +1,103 @@
+#include "core/sample_generator.h"
+
+namespace naivebayes {
+    bool WriteSample(const Sample& sample, SampleFormat format, std::ostream& output) {
+        int num_pixels = sample.GetSampleLength();
+        if (format == kPackedSamples) {
+            const vector<uint64_t>& words = sample.GetPackedPixels();
+            int digit = sample.GetDigit();
+            char label = static_cast<char>(digit >= 0 && digit <= 9 ? digit : 255);
+            output.put(label);
+            output.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+            return output.good();
+        }
+        string record = std::to_string(sample.GetDigit()) + "\n";
+        for (int r = 0; r < num_pixels; r++) {
+            for (int c = 0; c < num_pixels; c++) {
+                int shade = sample.GetPixel(r, c);
+                record += shade == 0 ? ' ' : (shade == sample.GetNumShades() - 1 ? '#' : '+');
+            }
+            record += '\n';
+        }
+        output << record;
+        return output.good();
+    }
+
+    SampleGenerator::SampleGenerator(Model& model, uint64_t seed)
+            : num_pixels_(model.GetSampleLength()), num_shades_(model.GetNumShades()), random_(seed) {
+        if (num_pixels_ < 0) {
+            return;
+        }
+        double total = 0;
+        for (int c = 0; c < 10; c++) {
+            total += model.GetPrior(c);
+            prior_cdf_[c] = total;
+        }
+        for (int c = 0; c < 10; c++) {
+            prior_cdf_[c] /= total;
+        }
+
+        size_t pixel_count = (size_t) num_pixels_ * num_pixels_;
+        shade_cdf_.resize(10 * pixel_count * (num_shades_ - 1));
+        double* tail = shade_cdf_.data();
+        for (int c = 0; c < 10; c++) {
+            for (int r = 0; r < num_pixels_; r++) {
+                for (int col = 0; col < num_pixels_; col++) {
+                    // Summed from the darkest shade down, so every entry is P(shade >= v)
+                    double above = 0;
+                    for (int v = num_shades_ - 1; v >= 1; v--) {
+                        above += model.GetLikelihood(c, v, r, col);
+                        tail[v - 1] = above;
+                    }
+                    tail += num_shades_ - 1;
+                }
+            }
+        }
+        words_.resize(((num_shades_ - 1) * pixel_count + Sample::kWordBits - 1) / Sample::kWordBits);
+    }
+
+    double SampleGenerator::Uniform() {
+        return (random_() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    bool SampleGenerator::Next(Sample& sample) {
+        if (num_pixels_ < 0) {
+            return false;
+        }
+        double u = Uniform();
+        int digit = 0;
+        while (digit < 9 && u >= prior_cdf_[digit]) {
+            digit++;
+        }
+
+        size_t pixel_count = (size_t) num_pixels_ * num_pixels_;
+        const double* tail = &shade_cdf_[digit * pixel_count * (num_shades_ - 1)];
+        std::fill(words_.begin(), words_.end(), 0);
+        for (size_t p = 0; p < pixel_count; p++, tail += num_shades_ - 1) {
+            u = Uniform();
+            int shade = 0;
+            while (shade + 1 < num_shades_ && u < tail[shade]) {
+                shade++;
+            }
+            if (shade > 0) {
+                size_t bit = (shade - 1) * pixel_count + p;
+                words_[bit / Sample::kWordBits] |= (uint64_t) 1 << (bit % Sample::kWordBits);
+            }
+        }
+
+        if (sample.GetSampleLength() != num_pixels_ || sample.GetNumShades() != num_shades_) {
+            sample.Reset(num_pixels_, num_shades_);
+        }
+        sample.SetPackedPixels(words_.data(), words_.size());
+        sample.SetDigit(digit);
+        return true;
+    }
+
+    int SampleGenerator::GetSampleLength() const {
+        return num_pixels_;
+    }
+
+    int SampleGenerator::GetNumShades() const {
+        return num_shades_;
+    }
+}
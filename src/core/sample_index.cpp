@@ -0,0 +1,248 @@
+#include "core/sample_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include "core/logger.h"
+#include "core/metrics.h"
+#include "core/model_file.h"
+
+namespace naivebayes {
+    namespace {
+        // Blocks hashed of a sample file, and their size
+        const size_t kHashBlocks = 64;
+        const size_t kHashBlockSize = 4096;
+
+        // Returns the modification time of a file, -1 if it has none
+        int64_t ModificationTime(const std::string& fileName) {
+            struct stat status;
+            if (stat(fileName.c_str(), &status) != 0) {
+                return -1;
+            }
+            return status.st_mtime;
+        }
+    }
+
+    uint64_t GetSampleIndexHash(const char* data, size_t size) {
+        if (size <= kHashBlocks * kHashBlockSize) {
+            return ModelFileChecksum(data, size);
+        }
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < kHashBlocks; i++) {
+            size_t start = i * (size - kHashBlockSize) / (kHashBlocks - 1);
+            hash ^= ModelFileChecksum(data + start, kHashBlockSize);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    SampleIndex::SampleIndex() : num_skipped_(0), data_mtime_(-1) {}
+
+    std::string SampleIndex::GetSidecarName(const std::string& sampleFile) {
+        return sampleFile + ".idx";
+    }
+
+    Status SampleIndex::Build(const std::string& sampleFile, int num_shades) {
+        Clear();
+        Status status = OpenFile(sampleFile, num_shades);
+        if (!status.IsOk()) {
+            return status;
+        }
+        Scan(sampleFile);
+        return status;
+    }
+
+    Status SampleIndex::Save(const std::string& indexFile) const {
+        std::ofstream my_file(indexFile, std::ios::binary);
+        if (!my_file.is_open()) {
+            return Status(kIoError, "Cannot open file for writing: " + indexFile);
+        }
+        size_t num_records = offsets_.size();
+        std::vector<char> payload(num_records * (sizeof(uint64_t) + 1));
+        if (num_records > 0) {
+            memcpy(&payload[0], offsets_.data(), num_records * sizeof(uint64_t));
+            memcpy(&payload[num_records * sizeof(uint64_t)], labels_.data(), num_records);
+        }
+        SampleIndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, kSampleIndexMagic, sizeof(header.magic));
+        header.version = kSampleIndexVersion;
+        header.num_records = num_records;
+        header.num_skipped = num_skipped_;
+        header.data_size = reader_.GetSize();
+        header.data_mtime = data_mtime_;
+        header.data_hash = GetSampleIndexHash(reader_.GetData(), reader_.GetSize());
+        header.checksum = ModelFileChecksum(payload.data(), payload.size());
+        if (!my_file.write(reinterpret_cast<const char*>(&header), sizeof(header)) ||
+            !my_file.write(payload.data(), payload.size())) {
+            return Status(kIoError, "Cannot write to file: " + indexFile);
+        }
+        return Status();
+    }
+
+    Status SampleIndex::Load(const std::string& sampleFile, const std::string& indexFile, int num_shades) {
+        Clear();
+        Status status = OpenFile(sampleFile, num_shades);
+        if (!status.IsOk()) {
+            return status;
+        }
+        return ReadSidecar(sampleFile, indexFile);
+    }
+
+    Status SampleIndex::Open(const std::string& sampleFile, int num_shades) {
+        Clear();
+        Status status = OpenFile(sampleFile, num_shades);
+        if (!status.IsOk()) {
+            return status;
+        }
+        std::string indexFile = GetSidecarName(sampleFile);
+        status = ReadSidecar(sampleFile, indexFile);
+        if (status.IsOk()) {
+            return status;
+        }
+        if (status.GetCode() != kIoError) {
+            NAIVE_BAYES_LOG(kLogWarning, status.GetMessage() << ", indexing it again");
+        }
+        Scan(sampleFile);
+        status = Save(indexFile);
+        if (!status.IsOk()) {
+            NAIVE_BAYES_LOG(kLogWarning, status.GetMessage());
+        }
+        return Status();
+    }
+
+    Status SampleIndex::OpenFile(const std::string& sampleFile, int num_shades) {
+        // Taken first, a change made while the file is being indexed leaves the index stale rather than wrong
+        data_mtime_ = ModificationTime(sampleFile);
+        if (!reader_.Open(sampleFile, num_shades)) {
+            return Status(kIoError, "File open error: " + sampleFile);
+        }
+        return Status();
+    }
+
+    void SampleIndex::Clear() {
+        offsets_.clear();
+        labels_.clear();
+        num_skipped_ = 0;
+        GroupByDigit();
+    }
+
+    void SampleIndex::Scan(const std::string& sampleFile) {
+        PhaseTimer timer(kParsePhase);
+        SampleReader scan = reader_;
+        Sample sample;
+        Status record;
+        while ((record = scan.Read(sample)).GetCode() != kEndOfInput) {
+            if (!record.IsOk()) {
+                num_skipped_++;
+                continue;
+            }
+            offsets_.push_back(scan.GetRecordOffset());
+            labels_.push_back(sample.GetDigit());
+        }
+        if (num_skipped_ > 0) {
+            NAIVE_BAYES_LOG(kLogWarning, "Index of " << sampleFile << " leaves out " << num_skipped_
+                                                     << " malformed samples");
+        }
+        GroupByDigit();
+    }
+
+    Status SampleIndex::ReadSidecar(const std::string& sampleFile, const std::string& indexFile) {
+        MappedFile file;
+        if (!file.Open(indexFile)) {
+            return Status(kIoError, "Cannot open file for reading: " + indexFile);
+        }
+        SampleIndexHeader header;
+        if (file.GetSize() < sizeof(header) || memcmp(file.GetData(), kSampleIndexMagic, sizeof(kSampleIndexMagic)) != 0) {
+            return Status(kFormatError, "Not a sample index file: " + indexFile);
+        }
+        memcpy(&header, file.GetData(), sizeof(header));
+        const char* payload = file.GetData() + sizeof(header);
+        size_t payload_size = file.GetSize() - sizeof(header);
+        if (header.version != kSampleIndexVersion || header.num_records > payload_size ||
+            payload_size != header.num_records * (sizeof(uint64_t) + 1) ||
+            header.checksum != ModelFileChecksum(payload, payload_size)) {
+            return Status(kFormatError, "Sample index file is corrupt: " + indexFile);
+        }
+        if (header.data_size != reader_.GetSize() || header.data_mtime != data_mtime_ ||
+            header.data_hash != GetSampleIndexHash(reader_.GetData(), reader_.GetSize())) {
+            return Status(kFormatError, "Sample index file " + indexFile + " was built from another " + sampleFile);
+        }
+        size_t num_records = header.num_records;
+        offsets_.resize(num_records);
+        if (num_records > 0) {
+            memcpy(offsets_.data(), payload, num_records * sizeof(uint64_t));
+        }
+        labels_.assign(payload + num_records * sizeof(uint64_t), payload + payload_size);
+        for (size_t i = 0; i < num_records; i++) {
+            if (labels_[i] > 9 || offsets_[i] >= header.data_size || (i > 0 && offsets_[i] <= offsets_[i - 1])) {
+                Clear();
+                return Status(kFormatError, "Sample index file is corrupt: " + indexFile);
+            }
+        }
+        num_skipped_ = header.num_skipped;
+        GroupByDigit();
+        return Status();
+    }
+
+    size_t SampleIndex::GetNumRecords() const {
+        return offsets_.size();
+    }
+
+    size_t SampleIndex::GetSkippedRecords() const {
+        return num_skipped_;
+    }
+
+    size_t SampleIndex::GetOffset(size_t record) const {
+        return offsets_[record];
+    }
+
+    int SampleIndex::GetDigit(size_t record) const {
+        return labels_[record];
+    }
+
+    const std::vector<size_t>& SampleIndex::GetRecordsOfDigit(int digit) const {
+        return digit_records_[digit];
+    }
+
+    Status SampleIndex::ReadAt(size_t record, Sample& sample) {
+        if (record >= offsets_.size()) {
+            return Status(kEndOfInput);
+        }
+        Status status = reader_.ReadAt(offsets_[record], sample);
+        // The sidecar only hashes part of a large file, an edit elsewhere shows up here
+        if (status.GetCode() != kEndOfInput &&
+            (reader_.GetRecordOffset() != offsets_[record] || sample.GetDigit() != labels_[record])) {
+            return Status(kFormatError, "Sample file does not match its index at record " + std::to_string(record));
+        }
+        return status;
+    }
+
+    SampleReader SampleIndex::GetReader(size_t first, size_t last) const {
+        if (first >= last || first >= offsets_.size()) {
+            return reader_.Slice(0, 0);
+        }
+        size_t end = last < offsets_.size() ? offsets_[last] : reader_.GetSize();
+        return reader_.Slice(offsets_[first], end);
+    }
+
+    std::vector<SampleReader> SampleIndex::Split(size_t num_parts) const {
+        size_t num_records = offsets_.size();
+        num_parts = std::max<size_t>(1, std::min(num_parts, num_records));
+        std::vector<SampleReader> parts;
+        for (size_t t = 0; t < num_parts; t++) {
+            parts.push_back(GetReader(t * num_records / num_parts, (t + 1) * num_records / num_parts));
+        }
+        return parts;
+    }
+
+    void SampleIndex::GroupByDigit() {
+        for (size_t d = 0; d < 10; d++) {
+            digit_records_[d].clear();
+        }
+        for (size_t i = 0; i < labels_.size(); i++) {
+            digit_records_[labels_[i]].push_back(i);
+        }
+    }
+}
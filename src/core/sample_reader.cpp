@@ -0,0 +1,171 @@
+#include "core/sample_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include "core/logger.h"
+
+namespace naivebayes {
+    SampleReader::SampleReader()
+            : begin_(nullptr), position_(nullptr), end_(nullptr), record_(nullptr), num_shades_(2) {}
+
+    SampleReader::SampleReader(const std::shared_ptr<MappedFile>& file, const char* begin, const char* end,
+                               int num_shades)
+            : file_(file), begin_(begin), position_(begin), end_(end), record_(begin), num_shades_(num_shades) {}
+
+    bool SampleReader::Open(const string& fileName, int num_shades) {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+        if (!file->Open(fileName)) {
+            *this = SampleReader();
+            return false;
+        }
+        *this = SampleReader(file, file->GetData(), file->GetData() + file->GetSize(), num_shades);
+        return true;
+    }
+
+    void SampleReader::Attach(const char* begin, const char* end, int num_shades) {
+        *this = SampleReader(std::shared_ptr<MappedFile>(), begin, end, num_shades);
+    }
+
+    const char* SampleReader::Base() const {
+        return file_ ? file_->GetData() : begin_;
+    }
+
+    const char* SampleReader::LineEnd() const {
+        const char* newline = static_cast<const char*>(memchr(position_, '\n', end_ - position_));
+        return newline != nullptr ? newline : end_;
+    }
+
+    Status SampleReader::Read(Sample& sample) {
+        // Blank lines between samples, e.g. at the end of a file, are not samples
+        while (position_ < end_ && *position_ == '\n') {
+            position_++;
+        }
+        record_ = position_;
+        if (position_ >= end_) {
+            return Status(kEndOfInput);
+        }
+        sample.digit_ = -1;
+        sample.num_pixels_ = sample.kSampleError;
+        sample.num_shades_ = num_shades_;
+
+        const char* line_end = LineEnd();
+        if (line_end - position_ != 1 || *position_ < '0' || *position_ > '9') {
+            return Malformed(sample, "expected a digit");
+        }
+        sample.digit_ = *position_ - '0';
+        position_ = line_end < end_ ? line_end + 1 : end_;
+
+        // The first row decides the dimension of the image, the others only have to match it
+        if (position_ >= end_) {
+            return Malformed(sample, "sample ends early");
+        }
+        line_end = LineEnd();
+        size_t length = line_end - position_;
+        if (length == 0) {
+            return Malformed(sample, "image has no pixels");
+        }
+        sample.Resize(length);
+        sample.DecodeRow(0, position_);
+        position_ = line_end < end_ ? line_end + 1 : end_;
+        for (size_t row = 1; row < length; row++) {
+            if (position_ >= end_) {
+                return Malformed(sample, "sample ends early");
+            }
+            line_end = LineEnd();
+            if ((size_t) (line_end - position_) != length) {
+                return Malformed(sample, "lines are not the same length");
+            }
+            sample.DecodeRow(row, position_);
+            position_ = line_end < end_ ? line_end + 1 : end_;
+        }
+        return Status();
+    }
+
+    Status SampleReader::Malformed(Sample& sample, const char* problem) {
+        sample.num_pixels_ = sample.kSampleError;
+        // The next sample starts at the next line holding just a digit, rows never do
+        while (position_ < end_ && !(LineEnd() - position_ == 1 && *position_ >= '0' && *position_ <= '9')) {
+            const char* line_end = LineEnd();
+            position_ = line_end < end_ ? line_end + 1 : end_;
+        }
+        std::ostringstream message;
+        message << "Training data format error at byte " << record_ - Base() << ": " << problem;
+        return Status(kFormatError, message.str());
+    }
+
+    bool SampleReader::Next(Sample& sample) {
+        Status status = Read(sample);
+        if (status.GetCode() == kFormatError) {
+            NAIVE_BAYES_LOG(kLogWarning, status.GetMessage());
+        }
+        return status.GetCode() != kEndOfInput;
+    }
+
+    Status SampleReader::ReadAt(size_t offset, Sample& sample) {
+        if (offset < (size_t) (begin_ - Base()) || offset >= (size_t) (end_ - Base())) {
+            position_ = end_;
+            return Status(kEndOfInput);
+        }
+        position_ = Base() + offset;
+        return Read(sample);
+    }
+
+    SampleReader SampleReader::Slice(size_t begin, size_t end) const {
+        const char* data = Base();
+        const char* slice_end = end < (size_t) (end_ - data) ? data + end : end_;
+        const char* slice_begin = begin < (size_t) (slice_end - data) ? std::max(data + begin, begin_) : slice_end;
+        return SampleReader(file_, slice_begin, slice_end, num_shades_);
+    }
+
+    size_t SampleReader::GetRecordOffset() const {
+        return record_ - Base();
+    }
+
+    vector<size_t> SampleReader::FindRecordOffsets() const {
+        // Samples start at the lines holding just a digit, as Malformed() finds them, rows never do.
+        // Splitting there keeps every malformed sample and blank line within one part, so the parts
+        // read the same samples, and fail the same way, as reading the whole input does.
+        vector<size_t> offsets;
+        for (const char* p = position_; p < end_; ) {
+            const char* newline = static_cast<const char*>(memchr(p, '\n', end_ - p));
+            const char* line_end = newline != nullptr ? newline : end_;
+            if (line_end - p == 1 && *p >= '0' && *p <= '9') {
+                offsets.push_back(p - Base());
+            }
+            if (newline == nullptr) {
+                break;
+            }
+            p = newline + 1;
+        }
+        return offsets;
+    }
+
+    vector<SampleReader> SampleReader::Split(size_t num_parts) const {
+        vector<size_t> offsets = FindRecordOffsets();
+        vector<SampleReader> parts;
+        if (num_parts <= 1 || offsets.size() <= 1) {
+            parts.push_back(*this);
+            return parts;
+        }
+        if (num_parts > offsets.size()) {
+            num_parts = offsets.size();
+        }
+        const char* data = Base();
+        for (size_t t = 0; t < num_parts; t++) {
+            size_t begin = t * offsets.size() / num_parts;
+            size_t end = (t + 1) * offsets.size() / num_parts;
+            parts.push_back(SampleReader(file_, data + offsets[begin],
+                                         end < offsets.size() ? data + offsets[end] : end_, num_shades_));
+        }
+        return parts;
+    }
+
+    size_t SampleReader::GetSize() const {
+        return end_ - begin_;
+    }
+
+    const char* SampleReader::GetData() const {
+        return begin_;
+    }
+}
@@ -0,0 +1,138 @@
+#include "core/scorer.h"
+#include "core/score_kernel.h"
+
+#include <cmath>
+
+namespace naivebayes {
+    Scorer::Scorer() {
+        num_pixels_ = -1;
+        num_shades_ = 0;
+        external_delta_ = nullptr;
+        for (int c = 0; c < kClassStride; c++) {
+            log_blank_[c] = 0;
+            log_prior_[c] = 0;
+            log_unshaded_[c] = 0;
+        }
+    }
+
+    void Scorer::Build(const double prior[10], const double* likelihood, int num_pixels, int num_shades) {
+        row_mask_.clear();
+        num_pixels_ = num_pixels;
+        num_shades_ = num_shades;
+        external_delta_ = nullptr;
+        if (num_pixels < 0) {
+            log_delta_.clear();
+            return;
+        }
+        size_t pixel_count = (size_t) num_pixels * num_pixels;
+        // Padding lanes stay at zero and are never looked at by the argmax
+        log_delta_.assign((num_shades - 1) * pixel_count * kClassStride, 0.0);
+        for (int c = 0; c < kClasses; c++) {
+            UpdateClass(c, likelihood + (size_t) c * num_shades * pixel_count);
+        }
+        SetPriors(prior);
+    }
+
+    void Scorer::UpdateClass(int digit, const double* likelihood) {
+        size_t pixel_count = (size_t) num_pixels_ * num_pixels_;
+        double log_unshaded_total = 0;
+        for (size_t p = 0; p < pixel_count; p++) {
+            double log_unshaded = std::log(likelihood[p]);
+            log_unshaded_total += log_unshaded;
+            // Row (v - 1) * pixel_count + p matches bit of the packed sample for shade v of pixel p
+            for (int v = 1; v < num_shades_; v++) {
+                size_t row = (v - 1) * pixel_count + p;
+                log_delta_[row * kClassStride + digit] = std::log(likelihood[v * pixel_count + p]) - log_unshaded;
+            }
+        }
+        log_unshaded_[digit] = log_unshaded_total;
+        log_blank_[digit] = log_prior_[digit] + log_unshaded_total;
+    }
+
+    void Scorer::SetPriors(const double prior[10]) {
+        for (int c = 0; c < kClasses; c++) {
+            log_prior_[c] = std::log(prior[c]);
+            log_blank_[c] = log_prior_[c] + log_unshaded_[c];
+        }
+    }
+
+    int Scorer::Score(const Sample& sample, double scores[kClassStride]) const {
+        if (num_pixels_ < 0 || sample.GetSampleLength() != num_pixels_ || sample.GetNumShades() != num_shades_) {
+            return -1;
+        }
+        for (int c = 0; c < kClassStride; c++) {
+            scores[c] = log_blank_[c];
+        }
+        AccumulateRows(GetDeltas(), sample.GetPackedPixels().data(), sample.GetPackedPixels().size(), scores,
+                       GetRowMask());
+
+        int best = 0;
+        for (int c = 1; c < kClasses; c++) {
+            if (scores[c] > scores[best]) {
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    void Scorer::Select(const vector<uint32_t>& pixels) {
+        row_mask_.clear();
+        if (num_pixels_ < 0 || pixels.empty()) {
+            return;
+        }
+        size_t pixel_count = (size_t) num_pixels_ * num_pixels_;
+        size_t rows = (num_shades_ - 1) * pixel_count;
+        row_mask_.assign((rows + Sample::kWordBits - 1) / Sample::kWordBits, 0);
+        for (size_t i = 0; i < pixels.size(); i++) {
+            if (pixels[i] >= pixel_count) {
+                continue;
+            }
+            for (int v = 1; v < num_shades_; v++) {
+                size_t row = (v - 1) * pixel_count + pixels[i];
+                row_mask_[row / Sample::kWordBits] |= (uint64_t) 1 << (row % Sample::kWordBits);
+            }
+        }
+    }
+
+    void Scorer::Assign(int num_pixels, int num_shades, const double* blank_scores, const double* deltas) {
+        row_mask_.clear();
+        num_pixels_ = num_pixels;
+        num_shades_ = num_shades;
+        for (int c = 0; c < kClassStride; c++) {
+            log_blank_[c] = blank_scores[c];
+        }
+        log_delta_.assign(deltas, deltas + (size_t) (num_shades - 1) * num_pixels * num_pixels * kClassStride);
+        external_delta_ = nullptr;
+    }
+
+    void Scorer::View(int num_pixels, int num_shades, const double* blank_scores, const double* deltas) {
+        row_mask_.clear();
+        num_pixels_ = num_pixels;
+        num_shades_ = num_shades;
+        for (int c = 0; c < kClassStride; c++) {
+            log_blank_[c] = blank_scores[c];
+        }
+        log_delta_.clear();
+        external_delta_ = deltas;
+    }
+
+    int Scorer::GetSampleLength() const {
+        return num_pixels_;
+    }
+
+    int Scorer::GetNumShades() const {
+        return num_shades_;
+    }
+
+    const double* Scorer::GetBlankScores() const {
+        return log_blank_;
+    }
+
+    const double* Scorer::GetDeltas() const {
+        return external_delta_ != nullptr ? external_delta_ : log_delta_.data();
+    }
+
+    const uint64_t* Scorer::GetRowMask() const {
+        return row_mask_.empty() ? nullptr : row_mask_.data();
+    }
+}
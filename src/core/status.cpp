@@ -0,0 +1,31 @@
+#include "core/status.h"
+
+namespace naivebayes {
+    namespace {
+        const char* const kCodeNames[] = {"ok", "end of input", "I/O error", "format error", "dimension mismatch",
+                                          "invalid model", "invalid argument"};
+    }
+
+    Status::Status() : code_(kOk) {}
+
+    Status::Status(StatusCode code, const std::string& message) : code_(code), message_(message) {}
+
+    bool Status::IsOk() const {
+        return code_ == kOk;
+    }
+
+    StatusCode Status::GetCode() const {
+        return code_;
+    }
+
+    const std::string& Status::GetMessage() const {
+        return message_;
+    }
+
+    std::string Status::ToString() const {
+        if (message_.empty()) {
+            return kCodeNames[code_];
+        }
+        return std::string(kCodeNames[code_]) + ": " + message_;
+    }
+}
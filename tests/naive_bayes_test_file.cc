@@ -1,9 +1,46 @@
 #include <catch2/catch.hpp>
 
+#include "core/classification_server.h"
+#include "core/cross_validation.h"
 #include "core/digit_classifier.h"
+#include "core/fixed_model.h"
+#include "core/logger.h"
+#include "core/metrics.h"
 #include "core/model.h"
+#include "core/sample_generator.h"
+#include "core/sample_index.h"
+#include "core/sample_reader.h"
+#include <cstdint>
+#include <cstring>
+#include <sstream>
 #define TWO_DECIMALS(x) (round(x * 100)/100)
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// std::filesystem needs C++17, the tests build as C++11
+bool FileExists(const string& fileName) {
+    return std::ifstream(fileName).good();
+}
+
+// Copies the first samples of a file of 28x28 samples, with a blank line after every sample,
+// leaving out the last row of sample number broken
+void WriteSpacedSamples(const string& from, const string& to, size_t count, size_t broken = SIZE_MAX) {
+    ifstream input(from);
+    ofstream output(to);
+    string line;
+    for (size_t i = 0; i < count * 29 && getline(input, line); i++) {
+        if (i != broken * 29 + 28) {
+            output << line << '\n';
+        }
+        if (i % 29 == 28) {
+            output << '\n';
+        }
+    }
+}
+
 TEST_CASE("Check consistency of reading training data from file, making sure the total equals the sum of all class samples") {
     SECTION("Checking sample total of test file") {
         naivebayes::Model model;
@@ -88,7 +125,7 @@ TEST_CASE("Testing Save and Load methods") {
 
     SECTION("Checking saving model to a file making sure the file exists.") {
         model1.Save("test.txt");
-        REQUIRE(std::__fs::filesystem::exists("test.txt"));
+        REQUIRE(FileExists("test.txt"));
     }
 
     SECTION("Checking loading back a model.") {
@@ -99,12 +136,58 @@ TEST_CASE("Testing Save and Load methods") {
 
     SECTION("Checking loading of nonexistent file.") {
         model2.Load("doesnotexist.txt");
-        REQUIRE(!std::__fs::filesystem::exists("doesnotexist.txt"));
+        REQUIRE(!FileExists("doesnotexist.txt"));
         REQUIRE(model2.GetSampleLength() == -1);
     }
     SECTION("Checking saving to non writable file") {
         model1.Save("/doesnotexist/test.txt");
-        REQUIRE(!std::__fs::filesystem::exists("/doesnotexist/test.txt"));
+        REQUIRE(!FileExists("/doesnotexist/test.txt"));
+    }
+}
+
+TEST_CASE("Testing the binary model format") {
+    naivebayes::Model model1;
+    naivebayes::Model model2;
+    model1.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    REQUIRE(model1.Save("test.bin", naivebayes::kBinaryModel) == 1);
+
+    SECTION("Binary models round trip exactly") {
+        REQUIRE(model2.Load("test.bin") == 1);
+        REQUIRE(model2.GetSampleLength() == 28);
+        for (int d = 0; d < 10; d++) {
+            REQUIRE(model2.GetPrior(d) == model1.GetPrior(d));
+            for (int v = 0; v < 2; v++) {
+                REQUIRE(model2.GetLikelihood(d, v, 14, 14) == model1.GetLikelihood(d, v, 14, 14));
+            }
+        }
+        naivebayes::Sample sample("../../../../../../tests/testoneimage.txt");
+        REQUIRE(model2.CalculateClassification(sample) == 5);
+    }
+
+    SECTION("Memory mapped binary models read the same tables") {
+        REQUIRE(model2.Map("test.bin") == 1);
+        REQUIRE(model2.GetSampleLength() == 28);
+        REQUIRE(model2.GetPrior(3) == model1.GetPrior(3));
+        REQUIRE(model2.GetLikelihood(7, 1, 10, 12) == model1.GetLikelihood(7, 1, 10, 12));
+        double digit_accuracy[10] = {0};
+        double mapped_accuracy[10] = {0};
+        REQUIRE(model2.Classify("../../../../../../tests/testimagesandlabels.txt", mapped_accuracy) ==
+                model1.Classify("../../../../../../tests/testimagesandlabels.txt", digit_accuracy));
+    }
+
+    SECTION("Text models cannot be memory mapped") {
+        model1.Save("test.txt");
+        REQUIRE(model2.Map("test.txt") == 0);
+        REQUIRE(model2.GetSampleLength() == -1);
+    }
+
+    SECTION("Corrupt binary models are rejected") {
+        std::fstream file("test.bin", std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(1000);
+        file.put('x');
+        file.close();
+        REQUIRE(model2.Load("test.bin") == 0);
+        REQUIRE(model2.GetSampleLength() == -1);
     }
 }
 
@@ -121,12 +204,325 @@ TEST_CASE("Building models for files that are not formatted correctly.") {
     }
 }
 
+TEST_CASE("Testing status reporting and skipping bad samples") {
+    SECTION("Skipping keeps every sample that fits the model") {
+        naivebayes::Model model;
+        naivebayes::Status status = model.TrainFile("../../../../../../tests/testinvalidimages.txt", 1,
+                                                    naivebayes::kSkipBadRecords);
+        REQUIRE(status.IsOk());
+        REQUIRE(model.GetSampleLength() == 2);
+        REQUIRE(model.GetSampleTotals() == 3);
+        REQUIRE(model.GetSkippedRecords() == 2);
+    }
+    SECTION("Stopping reports the first bad sample and invalidates the model") {
+        naivebayes::Model model;
+        naivebayes::Status status = model.TrainFile("../../../../../../tests/testinvalidimages.txt", 1,
+                                                    naivebayes::kStopOnBadRecord);
+        REQUIRE(status.GetCode() == naivebayes::kDimensionMismatch);
+        REQUIRE(status.GetMessage() == "Invalid sizes of images at byte 8");
+        REQUIRE(model.GetSampleLength() == -1);
+    }
+    SECTION("The reader carries on after a malformed sample") {
+        string data = "1\n##\n#\nx\n3\n #\n# \n\n";
+        naivebayes::SampleReader reader;
+        reader.Attach(data.data(), data.data() + data.size());
+        naivebayes::Sample sample;
+        naivebayes::Status status = reader.Read(sample);
+        REQUIRE(status.GetCode() == naivebayes::kFormatError);
+        REQUIRE(status.ToString() == "format error: Training data format error at byte 0: lines are not the same length");
+        REQUIRE(sample.GetSampleLength() == sample.kSampleError);
+        REQUIRE(reader.Read(sample).IsOk());
+        REQUIRE(reader.GetRecordOffset() == 9);
+        REQUIRE(sample.GetDigit() == 3);
+        REQUIRE(sample.GetSampleLength() == 2);
+        REQUIRE(reader.Read(sample).GetCode() == naivebayes::kEndOfInput);
+    }
+    SECTION("Errors of model files and predictions") {
+        naivebayes::Model model;
+        naivebayes::Sample sample(28);
+        REQUIRE(model.Predict(sample).GetStatus().GetCode() == naivebayes::kInvalidModel);
+        REQUIRE(model.SaveFile("test.bin", naivebayes::kBinaryModel).GetCode() == naivebayes::kInvalidModel);
+        REQUIRE(model.LoadFile("../../../../../../tests/doesnotexist.txt").GetCode() == naivebayes::kIoError);
+        REQUIRE(model.MapFile("../../../../../../tests/model.txt").GetCode() == naivebayes::kFormatError);
+        REQUIRE(model.TrainFile("../../../../../../tests/trainingimagesandlabels.txt").IsOk());
+        naivebayes::Result<int> digit = model.Predict(sample);
+        REQUIRE(digit.IsOk());
+        REQUIRE(digit.GetValue() >= 0);
+        naivebayes::Sample wrong_size(10);
+        REQUIRE(model.Predict(wrong_size).GetStatus().GetCode() == naivebayes::kDimensionMismatch);
+    }
+}
+
 TEST_CASE("Checking to see if the training data file with large number of training samples builds properly.") {
     naivebayes::Model model;
     model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
     REQUIRE(model.GetSampleTotals() == 5000);
 }
 
+TEST_CASE("Checking that a sharded multi-threaded build is identical to the serial build.") {
+    naivebayes::Model serial;
+    naivebayes::Model sharded;
+    serial.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    sharded.BuildModel("../../../../../../tests/trainingimagesandlabels.txt", 3);
+    REQUIRE(sharded.GetSampleTotals() == serial.GetSampleTotals());
+    REQUIRE(sharded.GetSampleLength() == serial.GetSampleLength());
+    for (int d = 0; d < 10; d++) {
+        REQUIRE(sharded.GetPrior(d) == serial.GetPrior(d));
+        for (int r = 0; r < serial.GetSampleLength(); r++) {
+            for (int c = 0; c < serial.GetSampleLength(); c++) {
+                REQUIRE(sharded.GetLikelihood(d, 1, r, c) == serial.GetLikelihood(d, 1, r, c));
+            }
+        }
+    }
+
+    SECTION("Blank lines between samples do not move shard boundaries") {
+        WriteSpacedSamples("../../../../../../tests/testimagesandlabels.txt", "spaced.txt", 400);
+        naivebayes::Model spaced_serial;
+        naivebayes::Model spaced_sharded;
+        REQUIRE(spaced_serial.TrainFile("spaced.txt", 1, naivebayes::kStopOnBadRecord).IsOk());
+        REQUIRE(spaced_sharded.TrainFile("spaced.txt", 4, naivebayes::kStopOnBadRecord).IsOk());
+        REQUIRE(spaced_serial.GetSampleTotals() == 400);
+        REQUIRE(spaced_sharded.GetSampleTotals() == 400);
+        for (int d = 0; d < 10; d++) {
+            REQUIRE(spaced_sharded.GetPrior(d) == spaced_serial.GetPrior(d));
+            for (int r = 0; r < 28; r++) {
+                for (int c = 0; c < 28; c++) {
+                    REQUIRE(spaced_sharded.GetLikelihood(d, 1, r, c) == spaced_serial.GetLikelihood(d, 1, r, c));
+                }
+            }
+        }
+
+        double digit_accuracy[10] = {0};
+        double threaded_accuracy[10] = {0};
+        double accuracy = serial.Classify("spaced.txt", digit_accuracy);
+        REQUIRE(serial.Classify("spaced.txt", threaded_accuracy, 4) == accuracy);
+        for (size_t i = 0; i < 10; i++) {
+            REQUIRE(threaded_accuracy[i] == digit_accuracy[i]);
+        }
+    }
+    SECTION("A malformed sample is skipped, and reported, the same way by every shard count") {
+        WriteSpacedSamples("../../../../../../tests/testimagesandlabels.txt", "broken.txt", 400, 50);
+        naivebayes::Model broken_serial;
+        naivebayes::Model broken_sharded;
+        REQUIRE(broken_serial.TrainFile("broken.txt", 1, naivebayes::kSkipBadRecords).IsOk());
+        REQUIRE(broken_sharded.TrainFile("broken.txt", 4, naivebayes::kSkipBadRecords).IsOk());
+        REQUIRE(broken_serial.GetSkippedRecords() == 1);
+        REQUIRE(broken_sharded.GetSkippedRecords() == 1);
+        REQUIRE(broken_serial.GetSampleTotals() == 399);
+        REQUIRE(broken_sharded.GetSampleTotals() == 399);
+        for (int d = 0; d < 10; d++) {
+            REQUIRE(broken_sharded.GetPrior(d) == broken_serial.GetPrior(d));
+        }
+
+        naivebayes::Model stopped_serial;
+        naivebayes::Model stopped_sharded;
+        naivebayes::Status serial_status = stopped_serial.TrainFile("broken.txt", 1, naivebayes::kStopOnBadRecord);
+        naivebayes::Status sharded_status = stopped_sharded.TrainFile("broken.txt", 4, naivebayes::kStopOnBadRecord);
+        REQUIRE(serial_status.GetCode() == naivebayes::kFormatError);
+        REQUIRE(sharded_status.GetMessage() == serial_status.GetMessage());
+    }
+    SECTION("Sharded build of a file where the samples have different dimensions") {
+        naivebayes::Model model;
+        model.BuildModel("../../../../../../tests/testinvalidimages.txt", 2);
+        REQUIRE(model.GetSampleLength() == -1);
+    }
+}
+
+TEST_CASE("Checking that incremental training matches a model built from the whole file.") {
+    naivebayes::Model built;
+    built.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    naivebayes::SampleReader reader;
+    reader.Open("../../../../../../tests/trainingimagesandlabels.txt");
+    vector<naivebayes::Sample> samples;
+    naivebayes::Sample sample;
+    while (reader.Next(sample)) {
+        samples.push_back(sample);
+    }
+
+    naivebayes::Model trained;
+    vector<naivebayes::Sample> first(samples.begin(), samples.begin() + 2500);
+    REQUIRE(trained.Train(first).GetValue() == 2500);
+    // Reading the model in between forces a refresh of the classes trained so far
+    REQUIRE(trained.GetPrior(0) > 0);
+    for (size_t i = 2500; i < samples.size(); i++) {
+        REQUIRE(trained.Train(samples[i]).IsOk());
+    }
+    REQUIRE(trained.GetSampleTotals() == built.GetSampleTotals());
+    for (int d = 0; d < 10; d++) {
+        REQUIRE(trained.GetPrior(d) == built.GetPrior(d));
+        for (int r = 0; r < built.GetSampleLength(); r++) {
+            for (int c = 0; c < built.GetSampleLength(); c++) {
+                REQUIRE(trained.GetLikelihood(d, 1, r, c) == built.GetLikelihood(d, 1, r, c));
+            }
+        }
+    }
+    double built_accuracy[10] = {0};
+    double trained_accuracy[10] = {0};
+    REQUIRE(trained.Classify("../../../../../../tests/testimagesandlabels.txt", trained_accuracy) ==
+            built.Classify("../../../../../../tests/testimagesandlabels.txt", built_accuracy));
+
+    SECTION("Training on a sample of the wrong size leaves the model intact") {
+        naivebayes::Sample small("../../../../../../tests/testinvalidimages.txt");
+        REQUIRE(trained.Train(small).GetCode() == naivebayes::kDimensionMismatch);
+        REQUIRE(trained.GetSampleLength() == 28);
+        REQUIRE(trained.GetSampleTotals() == 5000);
+    }
+    SECTION("A copy trained between predictions updates its own scoring tables only") {
+        naivebayes::Model copy(built);
+        naivebayes::Model fresh;
+        REQUIRE(fresh.Train(samples).GetValue() == 5000);
+        double log_posteriors[10];
+        double copy_posteriors[10];
+        for (size_t i = 0; i < 10; i++) {
+            REQUIRE(copy.Train(samples[i]).IsOk());
+            REQUIRE(fresh.Train(samples[i]).IsOk());
+            int digit = copy.CalculatePosteriors(samples[100 + i], copy_posteriors).GetValue();
+            REQUIRE(digit == fresh.CalculatePosteriors(samples[100 + i], log_posteriors).GetValue());
+            for (int c = 0; c < 10; c++) {
+                REQUIRE(copy_posteriors[c] == Approx(log_posteriors[c]));
+            }
+        }
+        double copy_accuracy[10] = {0};
+        REQUIRE(built.Classify("../../../../../../tests/testimagesandlabels.txt", copy_accuracy) ==
+                trained.Classify("../../../../../../tests/testimagesandlabels.txt", trained_accuracy));
+    }
+    SECTION("Training a loaded model is rejected") {
+        built.Save("test.txt");
+        naivebayes::Model loaded;
+        loaded.Load("test.txt");
+        REQUIRE(loaded.ProcessSample(samples[0]).GetCode() == naivebayes::kInvalidModel);
+        REQUIRE(loaded.Train(samples[0]).GetCode() == naivebayes::kInvalidModel);
+        REQUIRE(loaded.Train(samples).GetStatus().GetCode() == naivebayes::kInvalidModel);
+        REQUIRE(loaded.CalculateClassification(samples[1]) == built.CalculateClassification(samples[1]));
+    }
+}
+
+TEST_CASE("Checking that models trained on separate shards merge into the full model.") {
+    naivebayes::Model built;
+    built.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    naivebayes::SampleReader reader;
+    reader.Open("../../../../../../tests/trainingimagesandlabels.txt");
+    vector<naivebayes::SampleReader> parts = reader.Split(2);
+    naivebayes::Model first;
+    naivebayes::Model second;
+    naivebayes::Sample sample;
+    while (parts[0].Next(sample)) {
+        first.Train(sample);
+    }
+    while (parts[1].Next(sample)) {
+        second.Train(sample);
+    }
+    // The shards travel as binary files, which keep their counts
+    REQUIRE(second.Save("test.bin", naivebayes::kBinaryModel) == 1);
+    naivebayes::Model loaded;
+    REQUIRE(loaded.Load("test.bin") == 1);
+    REQUIRE(loaded.GetSampleTotals() == second.GetSampleTotals());
+
+    naivebayes::Model merged;
+    REQUIRE(merged.Merge(first).IsOk());
+    REQUIRE(merged.Merge(loaded).IsOk());
+    REQUIRE(merged.GetSampleTotals() == 5000);
+    for (int d = 0; d < 10; d++) {
+        REQUIRE(merged.GetPrior(d) == built.GetPrior(d));
+        for (int r = 0; r < built.GetSampleLength(); r++) {
+            for (int c = 0; c < built.GetSampleLength(); c++) {
+                REQUIRE(merged.GetLikelihood(d, 1, r, c) == built.GetLikelihood(d, 1, r, c));
+            }
+        }
+    }
+
+    SECTION("Subtracting a shard gives back the other shard") {
+        REQUIRE(merged.Subtract(loaded).IsOk());
+        REQUIRE(merged.GetSampleTotals() == first.GetSampleTotals());
+        for (int d = 0; d < 10; d++) {
+            REQUIRE(merged.GetPrior(d) == first.GetPrior(d));
+            REQUIRE(merged.GetLikelihood(d, 1, 14, 14) == first.GetLikelihood(d, 1, 14, 14));
+        }
+    }
+    SECTION("Subtracting counts that were never added is rejected") {
+        REQUIRE(first.Subtract(merged).GetCode() == naivebayes::kInvalidArgument);
+        REQUIRE(first.GetSampleTotals() + second.GetSampleTotals() == 5000);
+    }
+    SECTION("Models without counts cannot be merged") {
+        built.Save("test.txt");
+        naivebayes::Model text;
+        text.Load("test.txt");
+        REQUIRE(merged.Merge(text).GetCode() == naivebayes::kInvalidModel);
+        REQUIRE(text.Merge(first).GetCode() == naivebayes::kInvalidModel);
+    }
+    SECTION("The smoothing is saved with the model") {
+        REQUIRE(second.SetLaplace(0.01).IsOk());
+        naivebayes::ModelFormat formats[] = {naivebayes::kBinaryModel, naivebayes::kTextModel};
+        for (size_t f = 0; f < 2; f++) {
+            REQUIRE(second.Save("test.model", formats[f]) == 1);
+            REQUIRE(loaded.Load("test.model") == 1);
+            REQUIRE(loaded.GetLaplace() == 0.01);
+        }
+        REQUIRE(second.Save("test.bin", naivebayes::kBinaryModel) == 1);
+        REQUIRE(loaded.Load("test.bin") == 1);
+        REQUIRE(loaded.Map("test.bin") == 1);
+        REQUIRE(loaded.GetLaplace() == 0.01);
+        // Counts trained into the loaded model are smoothed like those of the saved one
+        REQUIRE(loaded.Load("test.bin") == 1);
+        REQUIRE(second.Train(sample).IsOk());
+        REQUIRE(loaded.Train(sample).IsOk());
+        for (int d = 0; d < 10; d++) {
+            REQUIRE(loaded.GetPrior(d) == second.GetPrior(d));
+            REQUIRE(loaded.GetLikelihood(d, 1, 0, 0) == second.GetLikelihood(d, 1, 0, 0));
+        }
+        // Loading a model saved with the default smoothing goes back to it
+        REQUIRE(first.Save("test.bin", naivebayes::kBinaryModel) == 1);
+        REQUIRE(loaded.Load("test.bin") == 1);
+        REQUIRE(loaded.GetLaplace() == 1.0);
+    }
+    SECTION("Models smoothed differently cannot be merged") {
+        naivebayes::Model smoothed(second);
+        REQUIRE(smoothed.SetLaplace(0.5).IsOk());
+        REQUIRE(merged.Merge(smoothed).GetCode() == naivebayes::kInvalidArgument);
+        REQUIRE(merged.Subtract(smoothed).GetCode() == naivebayes::kInvalidArgument);
+        REQUIRE(merged.GetSampleTotals() == 5000);
+    }
+}
+
+TEST_CASE("Checking that the compile-time sized model scores like the runtime scorer.") {
+    naivebayes::Model model;
+    model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    double prior[10];
+    vector<double> likelihood;
+    for (int d = 0; d < 10; d++) {
+        prior[d] = model.GetPrior(d);
+        for (int v = 0; v < 2; v++) {
+            for (int r = 0; r < 28; r++) {
+                for (int c = 0; c < 28; c++) {
+                    likelihood.push_back(model.GetLikelihood(d, v, r, c));
+                }
+            }
+        }
+    }
+    naivebayes::Scorer scorer;
+    scorer.Build(prior, likelihood.data(), 28, 2);
+    std::shared_ptr<const naivebayes::FixedModelBase> fixed =
+            naivebayes::MakeFixedModel(28, 2, scorer.GetBlankScores(), scorer.GetDeltas());
+    REQUIRE(fixed);
+    REQUIRE(fixed->GetSampleLength() == 28);
+
+    naivebayes::SampleReader reader;
+    reader.Open("../../../../../../tests/testimagesandlabels.txt");
+    naivebayes::Sample sample;
+    while (reader.Next(sample)) {
+        double expected[naivebayes::Scorer::kClassStride];
+        double actual[naivebayes::Scorer::kClassStride];
+        REQUIRE(fixed->Score(sample, actual) == scorer.Score(sample, expected));
+        for (int c = 0; c < 10; c++) {
+            REQUIRE(actual[c] == Approx(expected[c]));
+        }
+    }
+
+    SECTION("Dimensions without an instantiation fall back to the runtime scorer") {
+        REQUIRE(!naivebayes::MakeFixedModel(20, 2, scorer.GetBlankScores(), scorer.GetDeltas()));
+    }
+}
+
 TEST_CASE("Tests to see if samples are correctly classified.") {
     naivebayes::Model model;
     model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
@@ -144,6 +540,238 @@ TEST_CASE("Testing accuracy of classification for each digit in known test data.
     }
 }
 
+TEST_CASE("Testing classification with several worker threads matches the single threaded result.") {
+    naivebayes::Model model;
+    model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    double digit_accuracy[10] = {0};
+    double threaded_accuracy[10] = {0};
+    double accuracy = model.Classify("../../../../../../tests/testimagesandlabels.txt", digit_accuracy);
+    double threaded = model.Classify("../../../../../../tests/testimagesandlabels.txt", threaded_accuracy, 4);
+    REQUIRE(threaded == accuracy);
+    for (size_t i = 0; i < 10; i++) {
+        REQUIRE(threaded_accuracy[i] == digit_accuracy[i]);
+    }
+}
+
+TEST_CASE("Testing posterior probabilities and top-k predictions") {
+    naivebayes::Model model;
+    model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    naivebayes::SampleReader reader;
+    reader.Open("../../../../../../tests/testimagesandlabels.txt");
+    naivebayes::Sample sample;
+    while (reader.Next(sample)) {
+        double log_posteriors[10];
+        int top[3];
+        int digit = model.CalculatePosteriors(sample, log_posteriors, top, 3).GetValue();
+        REQUIRE(digit == model.CalculateClassification(sample));
+        REQUIRE(top[0] == digit);
+        double total = 0;
+        for (int c = 0; c < 10; c++) {
+            REQUIRE(log_posteriors[c] <= 0);
+            total += exp(log_posteriors[c]);
+        }
+        REQUIRE(total == Approx(1.0));
+        REQUIRE(log_posteriors[top[0]] >= log_posteriors[top[1]]);
+        REQUIRE(log_posteriors[top[1]] >= log_posteriors[top[2]]);
+    }
+
+    SECTION("Asking for more than ten digits returns all of them") {
+        naivebayes::Sample one("../../../../../../tests/testoneimage.txt");
+        double log_posteriors[10];
+        int top[12] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+        REQUIRE(model.CalculatePosteriors(one, log_posteriors, top, 12).GetValue() == 5);
+        REQUIRE(top[9] != -1);
+        REQUIRE(top[10] == -1);
+    }
+    SECTION("Posteriors of a sample that does not fit the model") {
+        naivebayes::Sample small("../../../../../../tests/testinvalidimages.txt");
+        double log_posteriors[10];
+        naivebayes::Result<int> digit = model.CalculatePosteriors(small, log_posteriors);
+        REQUIRE(digit.GetStatus().GetCode() == naivebayes::kDimensionMismatch);
+    }
+    SECTION("Top digits without an array to write them to are rejected") {
+        naivebayes::Sample one("../../../../../../tests/testoneimage.txt");
+        double log_posteriors[10];
+        naivebayes::Result<int> digit = model.CalculatePosteriors(one, log_posteriors, nullptr, 3);
+        REQUIRE(digit.GetStatus().GetCode() == naivebayes::kInvalidArgument);
+        REQUIRE(model.CalculatePosteriors(one, log_posteriors).GetValue() == 5);
+    }
+}
+
+TEST_CASE("Testing pixel selection by mutual information") {
+    naivebayes::Model model;
+    model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    REQUIRE(model.SelectPixels(0).GetCode() == naivebayes::kInvalidArgument);
+    REQUIRE(model.SelectPixels(200).IsOk());
+    const vector<uint32_t>& selected = model.GetSelectedPixels();
+    REQUIRE(selected.size() == 200);
+    for (size_t i = 1; i < selected.size(); i++) {
+        REQUIRE(selected[i] > selected[i - 1]);
+    }
+    // The corner is blank in every digit and tells nothing about the label
+    REQUIRE(selected[0] != 0);
+    REQUIRE(model.GetLikelihood(3, 0, 0, 0) == 0.5);
+    REQUIRE(model.GetLikelihood(3, 1, 0, 0) == 0.5);
+    double digit_accuracy[10] = {0};
+    double accuracy = model.Classify("../../../../../../tests/testimagesandlabels.txt", digit_accuracy);
+    REQUIRE(accuracy > 0.65);
+
+    SECTION("Selected models save only the selected pixels") {
+        naivebayes::Model full;
+        full.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+        REQUIRE(full.Save("test.bin", naivebayes::kBinaryModel) == 1);
+        std::ifstream full_file("test.bin", std::ios::binary | std::ios::ate);
+        std::streamoff full_size = full_file.tellg();
+        full_file.close();
+        REQUIRE(model.Save("test.bin", naivebayes::kBinaryModel) == 1);
+        std::ifstream selected_file("test.bin", std::ios::binary | std::ios::ate);
+        REQUIRE(selected_file.tellg() < full_size);
+        selected_file.close();
+
+        naivebayes::Model loaded;
+        REQUIRE(loaded.Load("test.bin") == 1);
+        REQUIRE(loaded.GetSelectedPixels() == model.GetSelectedPixels());
+        REQUIRE(loaded.GetLikelihood(3, 0, 0, 0) == 0.5);
+        REQUIRE(loaded.GetLikelihood(5, 1, 14, 14) == model.GetLikelihood(5, 1, 14, 14));
+        double loaded_accuracy[10] = {0};
+        REQUIRE(loaded.Classify("../../../../../../tests/testimagesandlabels.txt", loaded_accuracy) == accuracy);
+        // The counts of every pixel are kept, so the selection can be widened again
+        REQUIRE(loaded.SelectPixels(28 * 28).IsOk());
+        REQUIRE(loaded.GetSelectedPixels().empty());
+        REQUIRE(loaded.GetLikelihood(5, 1, 14, 14) == full.GetLikelihood(5, 1, 14, 14));
+
+        naivebayes::Model mapped;
+        REQUIRE(mapped.Map("test.bin") == 1);
+        REQUIRE(mapped.GetSelectedPixels() == model.GetSelectedPixels());
+        double mapped_accuracy[10] = {0};
+        REQUIRE(mapped.Classify("../../../../../../tests/testimagesandlabels.txt", mapped_accuracy) == accuracy);
+    }
+    SECTION("Text models with selected pixels outside the image are rejected") {
+        const char* const headers[] = {"28 2 1\n4000000000\n", "28 2 2\n5 3\n", "28 2 1\nx\n"};
+        for (size_t i = 0; i < 3; i++) {
+            ofstream corrupt("corrupt.txt");
+            corrupt << headers[i];
+            corrupt.close();
+            naivebayes::Model loaded;
+            REQUIRE(loaded.LoadFile("corrupt.txt").GetCode() == naivebayes::kFormatError);
+            REQUIRE(loaded.GetSampleLength() == -1);
+            REQUIRE(loaded.GetSelectedPixels().empty());
+            REQUIRE(loaded.Save("corrupt.bin", naivebayes::kBinaryModel) == 0);
+        }
+    }
+    SECTION("Selected models round trip through the text format") {
+        REQUIRE(model.Save("test.txt") == 1);
+        naivebayes::Model loaded;
+        REQUIRE(loaded.Load("test.txt") == 1);
+        REQUIRE(loaded.GetSelectedPixels() == model.GetSelectedPixels());
+        REQUIRE(loaded.SelectPixels(100).GetCode() == naivebayes::kInvalidModel);
+        naivebayes::SampleReader reader;
+        reader.Open("../../../../../../tests/testimagesandlabels.txt");
+        naivebayes::Sample sample;
+        while (reader.Next(sample)) {
+            REQUIRE(loaded.CalculateClassification(sample) == model.CalculateClassification(sample));
+        }
+    }
+}
+
+// Counts how often a log message was formatted
+int FormatCount(int& count) {
+    return ++count;
+}
+
+TEST_CASE("Testing the logger") {
+    std::ostringstream output;
+    naivebayes::Logger& logger = naivebayes::Logger::Global();
+    logger.SetOutput(&output);
+    SECTION("Messages below the level are neither written nor formatted") {
+        naivebayes::Logger::SetLevel(naivebayes::kLogWarning);
+        int formatted = 0;
+        NAIVE_BAYES_LOG(naivebayes::kLogInfo, "hidden " << FormatCount(formatted));
+        NAIVE_BAYES_LOG(naivebayes::kLogWarning, "shown " << FormatCount(formatted));
+        NAIVE_BAYES_LOG(naivebayes::kLogError, "also shown");
+        logger.Flush();
+        REQUIRE(formatted == 1);
+        REQUIRE(output.str() == "shown 1\nalso shown\n");
+    }
+    SECTION("Messages keep their order") {
+        naivebayes::Logger::SetLevel(naivebayes::kLogDebug);
+        string expected;
+        for (int i = 0; i < 10000; i++) {
+            NAIVE_BAYES_LOG(naivebayes::kLogDebug, i);
+            expected += std::to_string(i) + "\n";
+        }
+        logger.Flush();
+        REQUIRE(output.str() == expected);
+    }
+    SECTION("Invalid samples are reported only when warnings are enabled") {
+        naivebayes::Logger::SetLevel(naivebayes::kLogError);
+        naivebayes::Model model;
+        model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+        naivebayes::Sample wrong_size(10);
+        REQUIRE(model.CalculateClassification(wrong_size) == -1);
+        logger.Flush();
+        REQUIRE(output.str() == "");
+        naivebayes::Logger::SetLevel(naivebayes::kLogWarning);
+        REQUIRE(model.CalculateClassification(wrong_size) == -1);
+        logger.Flush();
+        REQUIRE(output.str() == "Invalid sample dimensions.\n");
+    }
+    logger.SetOutput(&cout);
+    naivebayes::Logger::SetLevel(naivebayes::kLogInfo);
+}
+
+TEST_CASE("Testing the metrics registry") {
+    naivebayes::Metrics& metrics = naivebayes::Metrics::Global();
+    metrics.Reset();
+    SECTION("Nothing is recorded while disabled") {
+        naivebayes::Model model;
+        model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+        REQUIRE(metrics.GetCount(naivebayes::kSamplesParsed) == 0);
+        REQUIRE(metrics.GetTime(naivebayes::kParsePhase) == 0);
+    }
+    SECTION("Training and classification are counted and timed") {
+        naivebayes::Metrics::SetEnabled(true);
+        naivebayes::Model model;
+        model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt", 2);
+        REQUIRE(metrics.GetCount(naivebayes::kSamplesParsed) == 5000);
+        REQUIRE(metrics.GetCount(naivebayes::kSamplesTrained) == 5000);
+        REQUIRE(metrics.GetCount(naivebayes::kInvalidSamples) == 0);
+        REQUIRE(metrics.GetCount(naivebayes::kBytesRead) > 0);
+        REQUIRE(metrics.GetTime(naivebayes::kParsePhase) > 0);
+        REQUIRE(metrics.GetTime(naivebayes::kTrainPhase) > 0);
+        REQUIRE(metrics.GetTime(naivebayes::kBuildTablesPhase) > 0);
+
+        naivebayes::Sample sample("../../../../../../tests/testoneimage.txt");
+        model.CalculateClassification(sample);
+        naivebayes::Sample wrong_size(10);
+        REQUIRE(model.CalculateClassification(wrong_size) == -1);
+        naivebayes::Metrics::SetEnabled(false);
+        REQUIRE(metrics.GetLatencyCount() == 1);
+        REQUIRE(metrics.GetCount(naivebayes::kSamplesClassified) == 1);
+        REQUIRE(metrics.GetCount(naivebayes::kInvalidSamples) == 1);
+
+        std::ostringstream json;
+        metrics.WriteJson(json);
+        REQUIRE(json.str().find("\"samples_trained\": 5000") != string::npos);
+        REQUIRE(json.str().find("\"classification_latency\": {\"count\": 1") != string::npos);
+        std::ostringstream prometheus;
+        metrics.WritePrometheus(prometheus);
+        REQUIRE(prometheus.str().find("naivebayes_samples_trained_total 5000\n") != string::npos);
+        REQUIRE(prometheus.str().find("naivebayes_classification_latency_seconds_bucket{le=\"+Inf\"} 1\n") !=
+                string::npos);
+        REQUIRE(prometheus.str().find("naivebayes_classification_latency_seconds_count 1\n") != string::npos);
+    }
+    SECTION("Reset clears everything") {
+        metrics.AddCount(naivebayes::kBytesRead, 10);
+        metrics.RecordLatency(1000);
+        metrics.Reset();
+        REQUIRE(metrics.GetCount(naivebayes::kBytesRead) == 0);
+        REQUIRE(metrics.GetLatencyCount() == 0);
+    }
+    naivebayes::Metrics::SetEnabled(false);
+    metrics.Reset();
+}
+
 TEST_CASE("Testing classification of file with one sample") {
     naivebayes::Sample sample("../../../../../../tests/testoneimage.txt");
     naivebayes::Model model;
@@ -192,4 +820,483 @@ TEST_CASE("Test public methods in sample: getters and setters") {
         naivebayes::Sample sample("../../../../../../tests/testoneimage.txt");
         REQUIRE(sample.SetPixel(100, 200, 10) == -1);
     }
+    SECTION("Test packed pixel storage of a 28x28 sample") {
+        naivebayes::Sample sample("../../../../../../tests/testoneimage.txt");
+        // 784 pixels fit in 13 words
+        REQUIRE(sample.GetPackedPixels().size() == 13);
+        REQUIRE(sample.GetPixel(5, 16) == 1);
+        sample.SetPixel(5, 16, 0);
+        REQUIRE(sample.GetPixel(5, 16) == 0);
+        sample.SetPixel(27, 27, 1);
+        REQUIRE(sample.GetPackedPixels()[12] == (uint64_t(1) << 15));
+    }
+}
+
+TEST_CASE("Test reusing one sample for every record") {
+    SECTION("operator>> refills the sample in its own storage") {
+        ifstream my_file("../../../../../../tests/testimagesandlabels.txt");
+        naivebayes::SampleReader reader;
+        reader.Open("../../../../../../tests/testimagesandlabels.txt");
+        naivebayes::Sample sample;
+        naivebayes::Sample mapped;
+        my_file >> sample;
+        const uint64_t* storage = sample.GetPackedPixels().data();
+        size_t count = 0;
+        while (sample.GetSampleLength() >= 0 && reader.Next(mapped)) {
+            REQUIRE(sample.GetPackedPixels().data() == storage);
+            REQUIRE(sample.GetDigit() == mapped.GetDigit());
+            REQUIRE(sample.GetPackedPixels() == mapped.GetPackedPixels());
+            count++;
+            my_file >> sample;
+        }
+        REQUIRE(count == 1000);
+    }
+    SECTION("A malformed record does not keep the previous image") {
+        std::istringstream input("1\n # \n###\n   \nx\n");
+        naivebayes::Sample sample;
+        input >> sample;
+        REQUIRE(sample.GetSampleLength() == 3);
+        REQUIRE(sample.GetDigit() == 1);
+        input >> sample;
+        REQUIRE(sample.GetSampleLength() == sample.kSampleError);
+        REQUIRE(sample.GetDigit() == -1);
+    }
+    SECTION("Reset clears the image and keeps the storage") {
+        naivebayes::Sample sample(28);
+        sample.SetDigit(4);
+        sample.SetPixel(3, 5, 1);
+        const uint64_t* storage = sample.GetPackedPixels().data();
+        REQUIRE(sample.Reset(28, 2) == 0);
+        REQUIRE(sample.GetPackedPixels().data() == storage);
+        REQUIRE(sample.GetPixel(3, 5) == 0);
+        REQUIRE(sample.GetDigit() == -1);
+        REQUIRE(sample.Reset(28, 3) == 0);
+        REQUIRE(sample.GetNumShades() == 3);
+        REQUIRE(sample.GetPackedPixels().size() == (2 * 28 * 28 + 63) / 64);
+        REQUIRE(sample.Reset(0, 2) == -1);
+        REQUIRE(sample.Reset(28, 1) == -1);
+    }
+}
+
+TEST_CASE("Test samples and models with three shade levels") {
+    SECTION("'+' and '#' are read as different shades") {
+        naivebayes::Sample sample("../../../../../../tests/testoneimage.txt", 3);
+        REQUIRE(sample.GetNumShades() == 3);
+        REQUIRE(sample.GetPixel(5, 15) == 0);
+        REQUIRE(sample.GetPixel(5, 16) == 1);
+        REQUIRE(sample.GetPixel(5, 21) == 2);
+        REQUIRE(sample.SetPixel(5, 21, 1) == 0);
+        REQUIRE(sample.GetPixel(5, 21) == 1);
+        REQUIRE(sample.SetPixel(5, 21, 3) == -1);
+    }
+    SECTION("A three shade model is trained, saved and loaded") {
+        naivebayes::Model model(3);
+        model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt", 2);
+        REQUIRE(model.GetNumShades() == 3);
+        double shades_total = 0;
+        for (int v = 0; v < 3; v++) {
+            shades_total += model.GetLikelihood(4, v, 14, 14);
+        }
+        REQUIRE(shades_total == Approx(1.0));
+        double digit_accuracy[10] = {0};
+        double accuracy = model.Classify("../../../../../../tests/testimagesandlabels.txt", digit_accuracy);
+        REQUIRE(accuracy > 0.70);
+
+        model.Save("test.txt");
+        naivebayes::Model text;
+        REQUIRE(text.Load("test.txt") == 1);
+        REQUIRE(text.GetNumShades() == 3);
+        REQUIRE(text.GetLikelihood(4, 2, 14, 14) == Approx(model.GetLikelihood(4, 2, 14, 14)));
+
+        model.Save("test.bin", naivebayes::kBinaryModel);
+        naivebayes::Model mapped;
+        REQUIRE(mapped.Map("test.bin") == 1);
+        REQUIRE(mapped.GetNumShades() == 3);
+        REQUIRE(mapped.Classify("../../../../../../tests/testimagesandlabels.txt", digit_accuracy) == accuracy);
+    }
+    SECTION("Samples quantized to a different number of shades are rejected") {
+        naivebayes::Model model;
+        model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+        naivebayes::Sample sample("../../../../../../tests/testoneimage.txt", 3);
+        REQUIRE(model.CalculateClassification(sample) == -1);
+        REQUIRE(model.Train(sample).GetCode() == naivebayes::kDimensionMismatch);
+    }
+}
+
+#if !defined(_WIN32)
+TEST_CASE("Test the classification server") {
+    naivebayes::Model model;
+    model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    vector<int> expected;
+    vector<naivebayes::Sample> samples;
+    naivebayes::SampleReader reader;
+    reader.Open("../../../../../../tests/testimagesandlabels.txt");
+    naivebayes::Sample sample;
+    while (reader.Next(sample)) {
+        samples.push_back(sample);
+        expected.push_back(model.CalculateClassification(sample));
+    }
+
+    SECTION("ASCII requests are answered in order") {
+        naivebayes::ClassificationServer server(model, naivebayes::kAsciiRequests, 16);
+        int input = open("../../../../../../tests/testimagesandlabels.txt", O_RDONLY);
+        int output = open("predictions.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        REQUIRE(server.Serve(input, output) == 1);
+        close(input);
+        close(output);
+        ifstream predictions("predictions.txt");
+        int digit;
+        size_t count = 0;
+        while (predictions >> digit) {
+            REQUIRE(count < expected.size());
+            REQUIRE(digit == expected[count]);
+            count++;
+        }
+        REQUIRE(count == expected.size());
+        naivebayes::ServerStats stats = server.GetStats();
+        REQUIRE(stats.requests == expected.size());
+        REQUIRE(stats.batches >= expected.size() / 16);
+        REQUIRE(stats.labelled == expected.size());
+        REQUIRE(stats.p50_latency <= stats.max_latency);
+    }
+    SECTION("Blank lines and a malformed request do not put later answers out of step") {
+        WriteSpacedSamples("../../../../../../tests/testimagesandlabels.txt", "spaced_requests.txt", 100, 10);
+        naivebayes::ClassificationServer server(model, naivebayes::kAsciiRequests, 16);
+        int input = open("spaced_requests.txt", O_RDONLY);
+        int output = open("predictions.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        REQUIRE(server.Serve(input, output) == 1);
+        close(input);
+        close(output);
+        ifstream predictions("predictions.txt");
+        int digit;
+        size_t count = 0;
+        while (predictions >> digit) {
+            REQUIRE(count < 100);
+            REQUIRE(digit == (count == 10 ? -1 : expected[count]));
+            count++;
+        }
+        REQUIRE(count == 100);
+    }
+    SECTION("Packed requests are answered in order") {
+        ofstream requests("requests.bin", std::ios::binary);
+        for (size_t i = 0; i < samples.size(); i++) {
+            char label = naivebayes::kUnknownLabel;
+            requests.write(&label, 1);
+            const vector<uint64_t>& words = samples[i].GetPackedPixels();
+            requests.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+        }
+        requests.close();
+        naivebayes::ClassificationServer server(model, naivebayes::kPackedRequests);
+        int input = open("requests.bin", O_RDONLY);
+        int output = open("predictions.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        REQUIRE(server.Serve(input, output) == 1);
+        close(input);
+        close(output);
+        ifstream predictions("predictions.txt");
+        int digit;
+        size_t count = 0;
+        while (predictions >> digit) {
+            REQUIRE(count < expected.size());
+            REQUIRE(digit == expected[count]);
+            count++;
+        }
+        REQUIRE(count == expected.size());
+        REQUIRE(server.GetStats().labelled == 0);
+    }
+    SECTION("An invalid model is not served") {
+        naivebayes::Model invalid;
+        naivebayes::ClassificationServer server(invalid);
+        REQUIRE(server.Serve(0, 1) == 0);
+    }
+}
+#endif
+
+TEST_CASE("Test the memory mapped sample reader") {
+    SECTION("Reader decodes the same samples as operator>>") {
+        naivebayes::SampleReader reader;
+        REQUIRE(reader.Open("../../../../../../tests/testimagesandlabels.txt"));
+        ifstream my_file("../../../../../../tests/testimagesandlabels.txt");
+        naivebayes::Sample mapped;
+        size_t count = 0;
+        while (reader.Next(mapped)) {
+            naivebayes::Sample parsed;
+            my_file >> parsed;
+            REQUIRE(mapped.GetDigit() == parsed.GetDigit());
+            REQUIRE(mapped.GetPackedPixels() == parsed.GetPackedPixels());
+            count++;
+        }
+        REQUIRE(count == 1000);
+    }
+    SECTION("Splitting a reader keeps every sample exactly once") {
+        naivebayes::SampleReader reader;
+        reader.Open("../../../../../../tests/testimagesandlabels.txt");
+        vector<naivebayes::SampleReader> parts = reader.Split(3);
+        REQUIRE(parts.size() == 3);
+        size_t count = 0;
+        naivebayes::Sample sample;
+        for (size_t i = 0; i < parts.size(); i++) {
+            while (parts[i].Next(sample)) {
+                REQUIRE(sample.GetSampleLength() == 28);
+                count++;
+            }
+        }
+        REQUIRE(count == 1000);
+    }
+    SECTION("Opening a nonexistent file") {
+        naivebayes::SampleReader reader;
+        REQUIRE(!reader.Open("../../../../../../tests/doesnotexist.txt"));
+    }
+}
+
+TEST_CASE("Test the record index") {
+    naivebayes::SampleIndex index;
+    REQUIRE(index.Build("../../../../../../tests/testimagesandlabels.txt").IsOk());
+    REQUIRE(index.GetNumRecords() == 1000);
+    REQUIRE(index.GetSkippedRecords() == 0);
+    SECTION("Records read out of order match the file") {
+        naivebayes::SampleReader reader;
+        reader.Open("../../../../../../tests/testimagesandlabels.txt");
+        vector<naivebayes::Sample> samples(1000);
+        for (size_t i = 0; i < samples.size(); i++) {
+            REQUIRE(reader.Next(samples[i]));
+        }
+        naivebayes::Sample sample;
+        for (size_t i = samples.size(); i-- > 0; ) {
+            REQUIRE(index.ReadAt(i, sample).IsOk());
+            REQUIRE(index.GetDigit(i) == samples[i].GetDigit());
+            REQUIRE(sample.GetDigit() == samples[i].GetDigit());
+            REQUIRE(sample.GetPackedPixels() == samples[i].GetPackedPixels());
+        }
+        REQUIRE(index.ReadAt(1000, sample).GetCode() == naivebayes::kEndOfInput);
+    }
+    SECTION("Records of one digit") {
+        size_t total = 0;
+        naivebayes::Sample sample;
+        for (int d = 0; d < 10; d++) {
+            const vector<size_t>& records = index.GetRecordsOfDigit(d);
+            total += records.size();
+            for (size_t i = 0; i < records.size(); i++) {
+                REQUIRE(index.ReadAt(records[i], sample).IsOk());
+                REQUIRE(sample.GetDigit() == d);
+            }
+        }
+        REQUIRE(total == 1000);
+    }
+    SECTION("Splitting gives runs of equal length") {
+        vector<naivebayes::SampleReader> parts = index.Split(3);
+        REQUIRE(parts.size() == 3);
+        naivebayes::Sample sample;
+        size_t counts[3] = {0};
+        for (size_t i = 0; i < parts.size(); i++) {
+            while (parts[i].Next(sample)) {
+                counts[i]++;
+            }
+        }
+        REQUIRE(counts[0] == 333);
+        REQUIRE(counts[1] == 333);
+        REQUIRE(counts[2] == 334);
+    }
+    SECTION("A saved index loads back for the same file only") {
+        REQUIRE(index.Save("test.idx").IsOk());
+        naivebayes::SampleIndex loaded;
+        REQUIRE(loaded.Load("../../../../../../tests/testimagesandlabels.txt", "test.idx").IsOk());
+        REQUIRE(loaded.GetNumRecords() == 1000);
+        for (size_t i = 0; i < 1000; i++) {
+            REQUIRE(loaded.GetOffset(i) == index.GetOffset(i));
+            REQUIRE(loaded.GetDigit(i) == index.GetDigit(i));
+        }
+        naivebayes::Status status = loaded.Load("../../../../../../tests/trainingimagesandlabels.txt", "test.idx");
+        REQUIRE(status.GetCode() == naivebayes::kFormatError);
+        REQUIRE(loaded.GetNumRecords() == 0);
+    }
+    SECTION("An index is refused after an edit that keeps the size of the file") {
+        WriteSpacedSamples("../../../../../../tests/testimagesandlabels.txt", "edited.txt", 400);
+        naivebayes::SampleIndex edited;
+        REQUIRE(edited.Build("edited.txt").IsOk());
+        REQUIRE(edited.Save("edited.txt.idx").IsOk());
+        naivebayes::SampleIndex loaded;
+        REQUIRE(loaded.Load("edited.txt", "edited.txt.idx").IsOk());
+        // A corrected label, then a changed pixel, of the first sample, which is in the first hashed block
+        size_t offsets[] = {edited.GetOffset(0), 2};
+        char digits[] = {char('0' + (edited.GetDigit(0) + 1) % 10), '#'};
+        for (size_t i = 0; i < 2; i++) {
+            std::fstream file("edited.txt", std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(offsets[i]);
+            file.put(digits[i]);
+            file.close();
+            REQUIRE(loaded.Load("edited.txt", "edited.txt.idx").GetCode() == naivebayes::kFormatError);
+            REQUIRE(loaded.GetNumRecords() == 0);
+            REQUIRE(edited.Build("edited.txt").IsOk());
+            REQUIRE(edited.Save("edited.txt.idx").IsOk());
+        }
+    }
+#if !defined(_WIN32)
+    SECTION("Reading a record checks it against the index") {
+        WriteSpacedSamples("../../../../../../tests/testimagesandlabels.txt", "edited.txt", 400);
+        naivebayes::SampleIndex edited;
+        REQUIRE(edited.Build("edited.txt").IsOk());
+        naivebayes::Sample sample;
+        REQUIRE(edited.ReadAt(100, sample).IsOk());
+        // The file is mapped, so a label corrected after indexing is what the next read sees
+        std::fstream file("edited.txt", std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(edited.GetOffset(100));
+        file.put(char('0' + (edited.GetDigit(100) + 1) % 10));
+        file.close();
+        REQUIRE(edited.ReadAt(100, sample).GetCode() == naivebayes::kFormatError);
+        REQUIRE(edited.ReadAt(101, sample).IsOk());
+    }
+#endif
+    SECTION("Malformed records are left out") {
+        naivebayes::SampleIndex invalid;
+        REQUIRE(invalid.Build("../../../../../../tests/testinvalidlinelengths.txt").IsOk());
+        REQUIRE(invalid.GetNumRecords() == 4);
+        REQUIRE(invalid.GetSkippedRecords() == 2);
+    }
+}
+
+TEST_CASE("Test stratified k-fold cross-validation") {
+    naivebayes::CrossValidator validator;
+    REQUIRE(validator.Open("../../../../../../tests/trainingimagesandlabels.txt", 5, 3).IsOk());
+    REQUIRE(validator.GetNumFolds() == 5);
+    REQUIRE(validator.GetSkippedRecords() == 0);
+    naivebayes::SampleIndex index;
+    REQUIRE(index.Build("../../../../../../tests/trainingimagesandlabels.txt").IsOk());
+    SECTION("Every fold holds out a fifth of every digit") {
+        size_t total = 0;
+        for (size_t f = 0; f < 5; f++) {
+            const vector<size_t>& records = validator.GetFoldRecords(f);
+            total += records.size();
+            REQUIRE(records.size() == 1000);
+            for (int d = 0; d < 10; d++) {
+                size_t count = 0;
+                for (size_t i = 0; i < records.size(); i++) {
+                    count += index.GetDigit(records[i]) == d;
+                }
+                size_t expected = index.GetRecordsOfDigit(d).size() / 5;
+                REQUIRE(count >= expected);
+                REQUIRE(count <= expected + 1);
+            }
+        }
+        REQUIRE(total == 5000);
+    }
+    SECTION("A fold scores like a model trained without its samples") {
+        naivebayes::Result<vector<naivebayes::FoldResult>> folds = validator.Evaluate(0.5, 4);
+        REQUIRE(folds.IsOk());
+        REQUIRE(folds.GetValue().size() == 5);
+        const vector<size_t>& held_out = validator.GetFoldRecords(2);
+        vector<bool> in_fold(index.GetNumRecords(), false);
+        for (size_t i = 0; i < held_out.size(); i++) {
+            in_fold[held_out[i]] = true;
+        }
+        naivebayes::Model model;
+        REQUIRE(model.SetLaplace(0.5).IsOk());
+        naivebayes::Sample sample;
+        for (size_t r = 0; r < index.GetNumRecords(); r++) {
+            if (!in_fold[r]) {
+                index.ReadAt(r, sample);
+                model.Train(sample);
+            }
+        }
+        size_t passed_digit[10] = {0};
+        for (size_t i = 0; i < held_out.size(); i++) {
+            index.ReadAt(held_out[i], sample);
+            passed_digit[sample.GetDigit()] += model.CalculateClassification(sample) == sample.GetDigit();
+        }
+        const naivebayes::FoldResult& fold = folds.GetValue()[2];
+        REQUIRE(fold.num_trained == 4000);
+        for (int d = 0; d < 10; d++) {
+            REQUIRE(fold.passed_digit[d] == passed_digit[d]);
+        }
+        REQUIRE(fold.GetAccuracy() > 0.7);
+    }
+    SECTION("Threads do not change the results") {
+        vector<naivebayes::FoldResult> serial = validator.Evaluate(1.0).GetValue();
+        vector<naivebayes::FoldResult> parallel = validator.Evaluate(1.0, 5).GetValue();
+        for (size_t f = 0; f < 5; f++) {
+            REQUIRE(serial[f].GetAccuracy() == parallel[f].GetAccuracy());
+        }
+    }
+    SECTION("Invalid arguments") {
+        REQUIRE(validator.Evaluate(0).GetStatus().GetCode() == naivebayes::kInvalidArgument);
+        naivebayes::CrossValidator unopened;
+        REQUIRE(unopened.Evaluate(1.0).GetStatus().GetCode() == naivebayes::kInvalidModel);
+        REQUIRE(unopened.Open("../../../../../../tests/testoneimage.txt", 2).GetCode() ==
+                naivebayes::kInvalidArgument);
+        naivebayes::Model model;
+        REQUIRE(model.SetLaplace(-1).GetCode() == naivebayes::kInvalidArgument);
+        REQUIRE(model.GetLaplace() == 1.0);
+    }
+}
+
+TEST_CASE("Test the synthetic sample generator") {
+    naivebayes::Model model;
+    model.BuildModel("../../../../../../tests/trainingimagesandlabels.txt");
+    SECTION("The same seed draws the same samples") {
+        naivebayes::SampleGenerator first(model, 7);
+        naivebayes::SampleGenerator second(model, 7);
+        naivebayes::Sample a;
+        naivebayes::Sample b;
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(first.Next(a));
+            REQUIRE(second.Next(b));
+            REQUIRE(a.GetDigit() == b.GetDigit());
+            REQUIRE(a.GetDigit() >= 0);
+            REQUIRE(a.GetDigit() <= 9);
+            REQUIRE(a.GetPackedPixels() == b.GetPackedPixels());
+        }
+    }
+    SECTION("ASCII samples read back through the sample reader") {
+        naivebayes::SampleGenerator generator(model, 3);
+        std::ostringstream output;
+        vector<naivebayes::Sample> written(20);
+        for (size_t i = 0; i < written.size(); i++) {
+            generator.Next(written[i]);
+            REQUIRE(naivebayes::WriteSample(written[i], naivebayes::kAsciiSamples, output));
+        }
+        string text = output.str();
+        naivebayes::SampleReader reader;
+        reader.Attach(text.data(), text.data() + text.size());
+        naivebayes::Sample sample;
+        size_t count = 0;
+        while (reader.Next(sample)) {
+            REQUIRE(sample.GetDigit() == written[count].GetDigit());
+            REQUIRE(sample.GetPackedPixels() == written[count].GetPackedPixels());
+            count++;
+        }
+        REQUIRE(count == written.size());
+    }
+    SECTION("Packed records hold the label and the pixel words") {
+        naivebayes::SampleGenerator generator(model, 5);
+        naivebayes::Sample sample;
+        generator.Next(sample);
+        std::ostringstream output;
+        naivebayes::WriteSample(sample, naivebayes::kPackedSamples, output);
+        string record = output.str();
+        size_t num_words = sample.GetPackedPixels().size();
+        REQUIRE(record.size() == 1 + num_words * sizeof(uint64_t));
+        REQUIRE(record[0] == sample.GetDigit());
+        vector<uint64_t> words(num_words);
+        memcpy(words.data(), record.data() + 1, num_words * sizeof(uint64_t));
+        REQUIRE(words == sample.GetPackedPixels());
+    }
+    SECTION("A model trained on generated samples is close to the original") {
+        naivebayes::SampleGenerator generator(model, 11);
+        naivebayes::Model trained;
+        naivebayes::Sample sample;
+        for (int i = 0; i < 20000; i++) {
+            generator.Next(sample);
+            trained.ProcessSample(sample);
+        }
+        for (int c = 0; c < 10; c++) {
+            REQUIRE(std::abs(trained.GetPrior(c) - model.GetPrior(c)) < 0.02);
+            REQUIRE(std::abs(trained.GetLikelihood(c, 1, 14, 14) - model.GetLikelihood(c, 1, 14, 14)) < 0.1);
+        }
+    }
+    SECTION("A model that was never trained draws nothing") {
+        naivebayes::Model empty;
+        naivebayes::SampleGenerator generator(empty, 1);
+        naivebayes::Sample sample;
+        REQUIRE(!generator.Next(sample));
+        REQUIRE(generator.GetSampleLength() == -1);
+    }
 }